@@ -9,6 +9,31 @@
 #include <thread>
 #include <atomic>
 #include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/utsname.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <spawn.h>
+#include <sys/syscall.h>
+#include <sched.h>
+#include <linux/mempolicy.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include <sys/inotify.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fnmatch.h>
 
 namespace fs = std::filesystem;
 
@@ -24,20 +49,101 @@ namespace ansi {
     const std::string cyan = "\033[36m";
 }
 
+static bool have_tool(const std::string &t){
+    return system(("command -v "+t+" >/dev/null 2>&1").c_str())==0;
+}
+
+// === classes de prioridade por etapa: nice, ionice e (opcional) io.weight de cgroup v2 ===
+// nice/ioprio valem por thread no Linux e são herdados pelos filhos, então cada etapa roda numa
+// thread própria com a classe aplicada; sem privilégio a prioridade só pode baixar.
+struct PrioClass { int nice{0}; int ioclass{0}; int iolevel{4}; int weight{0}; std::string cgroup; };
+
+// "19 idle 10" -> nice 19, ionice idle, io.weight 10; classes de I/O: rt[:N], be[:N], idle
+static PrioClass parse_prio(const std::string &s){
+    PrioClass p; std::stringstream ss(s); std::string io;
+    ss >> p.nice >> io >> p.weight;
+    auto colon = io.find(':');
+    std::string cls = io.substr(0, colon);
+    p.ioclass = cls=="rt" ? 1 : cls=="be" ? 2 : cls=="idle" ? 3 : 0;
+    if (colon!=std::string::npos) p.iolevel = std::clamp(std::atoi(io.c_str()+colon+1), 0, 7);
+    return p;
+}
+
+// prefixo dos comandos da thread atual (entrada no cgroup da classe)
+static thread_local std::string cmd_prefix;
+
+// cria o cgroup da classe (e habilita io no pai) só quando ela é usada pela primeira vez,
+// para comandos como help e search não mexerem em /sys/fs/cgroup
+static bool cgroup_ready(const PrioClass &p){
+    static std::mutex mu;
+    static std::map<std::string,bool> ready;
+    std::lock_guard<std::mutex> lk(mu);
+    auto it = ready.find(p.cgroup);
+    if (it!=ready.end()) return it->second;
+    fs::path dir = p.cgroup;
+    std::ofstream(dir.parent_path()/"cgroup.subtree_control") << "+io\n";
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    std::ofstream w(dir/"io.weight");
+    return ready[p.cgroup] = (bool)(w << "default " << std::clamp(p.weight, 1, 10000) << "\n" && w.flush());
+}
+
+static void apply_prio(const PrioClass &p){
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+    if (p.nice) setpriority(PRIO_PROCESS, tid, p.nice);
+    if (p.ioclass) syscall(SYS_ioprio_set, 1 /*IOPRIO_WHO_PROCESS*/, tid, (p.ioclass<<13) | (p.ioclass==3 ? 0 : p.iolevel));
+    cmd_prefix = p.cgroup.empty() || !cgroup_ready(p) ? "" : "echo $$ > '"+p.cgroup+"/cgroup.procs' 2>/dev/null; ";
+}
+
+static int run_at_prio(const PrioClass &p, const std::function<int()> &fn){
+    if (!p.nice && !p.ioclass && p.cgroup.empty()) return fn();
+    int rc = 0; std::exception_ptr ex;
+    std::thread t([&]{ apply_prio(p); try { rc = fn(); } catch (...) { ex = std::current_exception(); } });
+    t.join();
+    if (ex) std::rethrow_exception(ex);
+    return rc;
+}
+
+// número da última execução registrada em logs/<pkg>/ (arquivos <N>.log, <N>.log.zst, <N>.idx)
+static int last_run(const fs::path &dir){
+    int n=0; std::error_code ec;
+    if (!fs::is_directory(dir, ec)) return 0;
+    for (auto &e: fs::directory_iterator(dir, ec)){
+        std::string f = e.path().filename().string();
+        auto dot = f.find('.');
+        if (dot==0 || dot==std::string::npos || f.find_first_not_of("0123456789")!=dot) continue;
+        n = std::max(n, std::stoi(f.substr(0,dot)));
+    }
+    return n;
+}
+
 struct Logger {
     fs::path logFile;
     std::mutex mtx;
     bool toTTY{true};
+    // log da execução atual de um pacote; ao final vira <N>.log.zst com um frame por fase + <N>.idx
+    fs::path runFile;
+    std::ofstream run;
+    int runKeep{10};
+    std::vector<std::pair<std::string, uintmax_t>> phases;
+    // tempo de parede e CPU (filhos) por etapa da execução; vai para logs/timings.tsv no end_run
+    std::string stage;
+    std::chrono::steady_clock::time_point stageT0;
+    double stageCpu0{0};
+    std::map<std::string, std::pair<double,double>> stageTimes;
+    PrioClass gcPrio;   // compressão/retenção dos logs roda na classe gc
     Logger(const fs::path &f): logFile(f) {
         fs::create_directories(logFile.parent_path());
         std::ofstream ofs(logFile, std::ios::app);
     }
+    ~Logger(){ end_run(); }
     void write(const std::string &level, const std::string &msg, const std::string &color="") {
         std::lock_guard<std::mutex> lock(mtx);
         std::string line = level + ": " + msg + "\n";
         std::ofstream ofs(logFile, std::ios::app);
         ofs << line;
         ofs.close();
+        if (run.is_open()) { run << line; run.flush(); }
         if (toTTY) {
             if (!color.empty()) std::cerr << color;
             std::cerr << line << ansi::reset;
@@ -47,6 +153,140 @@ struct Logger {
     void ok(const std::string &m){ write("[ OK ]", m, ansi::green); }
     void warn(const std::string &m){ write("[WARN]", m, ansi::yellow); }
     void err(const std::string &m){ write("[ERR ]", m, ansi::red); }
+    // saída dos comandos: vai só para o log da execução, não para o cbuild.log global
+    void raw(const std::string &s){
+        std::lock_guard<std::mutex> lock(mtx);
+        if (run.is_open()) run << s;
+    }
+
+    // rotação do log global: cbuild.log -> cbuild.log.1.zst ... cbuild.log.<keep>.zst
+    void rotate(uintmax_t maxBytes, int keep){
+        std::error_code ec;
+        auto sz = fs::file_size(logFile, ec);
+        if (ec || maxBytes==0 || sz < maxBytes) return;
+        run_at_prio(gcPrio, [&]{ rotate_now(keep); return 0; });
+    }
+    void rotate_now(int keep){
+        std::error_code ec;
+        keep = std::max(keep, 1);
+        bool zst = have_tool("zstd");
+        auto nth=[&](int i){ return fs::path(logFile.string()+"."+std::to_string(i)+(zst?".zst":".gz")); };
+        fs::remove(nth(keep), ec);
+        for (int i=keep-1;i>=1;--i) if (fs::exists(nth(i))) fs::rename(nth(i), nth(i+1), ec);
+        std::string tool = zst ? "zstd -q -c" : "gzip -c";
+        if (system((tool+" '"+logFile.string()+"' > '"+nth(1).string()+"'").c_str())==0)
+            std::ofstream(logFile, std::ios::trunc);
+    }
+
+    void begin_run(const fs::path &dir, const std::string &title, int keep){
+        end_run();
+        fs::create_directories(dir);
+        int n = last_run(dir) + 1;
+        runKeep = keep;
+        runFile = dir/(std::to_string(n)+".log");
+        run.open(runFile, std::ios::trunc);
+        phases.clear();
+        phases.push_back({"-", 0});
+        stage.clear(); stageTimes.clear();
+        time_t now = time(nullptr); char ts[32]; strftime(ts, sizeof ts, "%Y-%m-%d %H:%M:%S", localtime(&now));
+        run << "# cbuild run " << n << " " << title << " " << ts << "\n";
+    }
+
+    // marcador de fase: cada fase vira um frame independente no arquivo comprimido
+    void phase(const std::string &p){
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!run.is_open()) return;
+        run.flush();
+        phases.push_back({p, (uintmax_t)run.tellp()});
+        run << "==> fase: " << p << "\n";
+        close_stage();
+        stage = stage_of(p);
+        stageT0 = std::chrono::steady_clock::now();
+        stageCpu0 = children_cpu();
+    }
+
+    // fases de comando/receita agrupadas nas etapas do pipeline
+    static std::string stage_of(const std::string &p){
+        if (p=="prebuild" || p=="prepare" || p=="configure" || p=="build") return "build";
+        if (p=="install" || p=="postinstall") return "install";
+        if (p=="fetch" || p=="extract" || p=="patch") return p;
+        return "";
+    }
+    static double children_cpu(){
+        struct rusage ru{};
+        getrusage(RUSAGE_CHILDREN, &ru);
+        return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec)/1e6;
+    }
+    void close_stage(){
+        if (stage.empty()) return;
+        auto &t = stageTimes[stage];
+        t.first += std::chrono::duration<double>(std::chrono::steady_clock::now()-stageT0).count();
+        t.second += children_cpu()-stageCpu0;
+        stage.clear();
+    }
+
+    void end_run(){
+        if (!run.is_open()) return;
+        run.close();
+        close_stage();
+        if (!stageTimes.empty()){
+            std::ofstream tf(runFile.parent_path().parent_path()/"timings.tsv", std::ios::app);
+            for (auto &kv: stageTimes)
+                tf << runFile.parent_path().filename().string() << '\t' << kv.first << '\t' << std::fixed << std::setprecision(2)
+                   << kv.second.first << '\t' << kv.second.second << '\t' << time(nullptr) << "\n";
+        }
+        run_at_prio(gcPrio, [&]{ compress_run(); return 0; });
+    }
+
+    void compress_run(){
+        bool zst = have_tool("zstd");
+        fs::path out = runFile; out += zst ? ".zst" : ".gz";
+        fs::path idx = runFile; idx.replace_extension(".idx");
+        std::error_code ec;
+        uintmax_t size = fs::file_size(runFile, ec);
+        fs::remove(out, ec);
+        std::ifstream in(runFile, std::ios::binary);
+        std::ostringstream ix;
+        ix << (zst ? "zstd" : "gzip") << "\n";
+        bool ok = true;
+        for (size_t i=0;i<phases.size() && ok;++i){
+            uintmax_t uoff = phases[i].second;
+            uintmax_t uend = (i+1<phases.size()) ? phases[i+1].second : size;
+            uintmax_t coff = fs::exists(out) ? fs::file_size(out) : 0;
+            FILE *p = popen(((zst ? "zstd -q -c >> '" : "gzip -c >> '")+out.string()+"'").c_str(), "w");
+            if (!p) { ok=false; break; }
+            in.seekg(uoff);
+            char buf[65536];
+            for (uintmax_t left=uend-uoff; left>0; ){
+                in.read(buf, std::min<uintmax_t>(left, sizeof buf));
+                if (in.gcount()<=0) break;
+                fwrite(buf, 1, in.gcount(), p);
+                left -= in.gcount();
+            }
+            ok = pclose(p)==0;
+            uintmax_t cend = fs::file_size(out, ec);
+            ix << phases[i].first << '\t' << coff << '\t' << (cend-coff) << '\t' << uoff << '\t' << (uend-uoff) << "\n";
+        }
+        in.close();
+        if (ok){
+            std::ofstream(idx, std::ios::trunc) << ix.str();
+            fs::remove(runFile, ec);
+        } else fs::remove(out, ec);   // mantém o .log em texto puro
+        prune_runs(runFile.parent_path(), runKeep);
+    }
+
+    // retenção: mantém só as últimas `keep` execuções do pacote
+    static void prune_runs(const fs::path &dir, int keep){
+        if (keep<=0) return;
+        int last = last_run(dir);
+        std::error_code ec;
+        for (auto &e: fs::directory_iterator(dir, ec)){
+            std::string f = e.path().filename().string();
+            auto dot = f.find('.');
+            if (dot==0 || dot==std::string::npos || f.find_first_not_of("0123456789")!=dot) continue;
+            if (std::stoi(f.substr(0,dot)) <= last-keep) fs::remove(e.path(), ec);
+        }
+    }
 };
 
 class Spinner {
@@ -66,18 +306,47 @@ public:
         });
     }
     void stop(){ running=false; if (th.joinable()) th.join(); }
+    ~Spinner(){ stop(); }
 };
 
 // exec helpers
-static int exec_cmd(const std::string &cmd, Logger &log, bool echo=true) {
+// popen que devolve o pid: com wait4 dá para ler o pico de memória do comando e dos filhos
+// que ele esperou, sem misturar com outros comandos deste processo (RUSAGE_CHILDREN acumula)
+static FILE *popen_pid(const std::string &cmd, pid_t &pid){
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC)!=0) return nullptr;
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_adddup2(&fa, fds[1], 1);
+    const char *argv[] = {"sh", "-c", cmd.c_str(), nullptr};
+    int rc = posix_spawn(&pid, "/bin/sh", &fa, nullptr, (char**)argv, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    close(fds[1]);
+    if (rc!=0) { close(fds[0]); return nullptr; }
+    return fdopen(fds[0], "r");
+}
+
+// com peak, guarda em *peak o maior RSS (bytes) visto no comando
+static int exec_cmd(const std::string &cmd, Logger &log, bool echo=true, std::string *out=nullptr, uintmax_t *peak=nullptr) {
     log.info("$ " + cmd);
-    FILE *pipe = popen((cmd + " 2>&1").c_str(), "r");
+    pid_t pid = 0;
+    FILE *pipe = peak ? popen_pid(cmd_prefix + cmd + " 2>&1", pid) : popen((cmd_prefix + cmd + " 2>&1").c_str(), "r");
     if (!pipe) { log.err("Falha ao executar: " + cmd); return 127; }
     char buf[4096];
     while (fgets(buf, sizeof(buf), pipe)) {
+        if (out) *out += buf;
+        log.raw(buf);
         if (echo) std::cerr << buf;
     }
-    int rc = pclose(pipe);
+    int rc;
+    if (peak){
+        fclose(pipe);
+        struct rusage ru{};
+        int st = 0, w;
+        while ((w = wait4(pid, &st, 0, &ru))<0 && errno==EINTR) {}
+        rc = w<0 ? -1 : st;
+        *peak = std::max<uintmax_t>(*peak, (uintmax_t)ru.ru_maxrss*1024);
+    } else rc = pclose(pipe);
     if (rc == -1) return 127;
     int code = WEXITSTATUS(rc);
     if (code==0) log.ok("rc=0"); else log.err("rc="+std::to_string(code));
@@ -92,12 +361,158 @@ static void exec_cmd_strict(const std::string &cmd, Logger &log, const std::stri
     }
 }
 
+// roda sem log nem eco, só captura stdout (consultas em massa: ls-remote, listagens...)
+static int read_cmd(const std::string &cmd, std::string &out){
+    FILE *p = popen(cmd.c_str(), "r");
+    if (!p) return 127;
+    char buf[4096]; size_t n;
+    while ((n=fread(buf,1,sizeof buf,p))>0) out.append(buf, n);
+    int rc = pclose(p);
+    return rc==-1 ? 127 : WEXITSTATUS(rc);
+}
+
+static std::string replace_all(std::string s, const std::string &from, const std::string &to){
+    if (from.empty()) return s;
+    for (size_t p=0; (p=s.find(from,p))!=std::string::npos; p+=to.size()) s.replace(p, from.size(), to);
+    return s;
+}
+
+// repositório remoto de receitas clonado em repo/<name>; maior prioridade vence
+struct RecipeRepo { std::string name, url; int priority{0}; };
+
 struct Config {
     fs::path base, recipes, sources, work, destroot, logs, repo, snapshots;
     bool color{true};
     bool verbose{true};
+    int log_keep{10};          // execuções guardadas por pacote em logs/<pkg>/
+    uintmax_t log_max_mb{64};  // tamanho que dispara a rotação do cbuild.log
+    int log_rotate{5};         // quantos cbuild.log.N.zst manter
+    bool mirror_probe{true};   // mede o tempo até o primeiro byte de cada espelho antes de baixar
+    int mirror_probe_timeout{5};
+    int fetch_retries{3};         // novas tentativas por arquivo (cada uma percorre os espelhos)
+    int fetch_backoff_ms{1000};   // espera base, dobra a cada tentativa (com jitter)
+    int fetch_backoff_max_ms{30000};
+    int fetch_min_speed{1024};    // B/s; abaixo disso por fetch_stall_secs a transferência é reiniciada
+    int fetch_stall_secs{30};
+    int fetch_per_host{2};        // downloads simultâneos por host (entre processos também)
+    int fetch_jobs{4};            // arquivos baixados em paralelo por receita
+    int git_jobs{8};              // submódulos buscados em paralelo
+    int watch_debounce_ms{300};   // silêncio exigido antes de processar mudanças no watch
+    int outdated_jobs{16};        // verificações upstream simultâneas
+    long outdated_ttl{6*3600};    // segundos que um resultado fica em cache
+    int sched_slots{0};           // builds concorrentes fixados em fatias de CPU; 0 = desligado, -1 = um por nó NUMA
+    bool sched_membind{false};    // prende também a memória aos nós do slot
+    std::map<std::string, PrioClass> prio;   // fetch, extract, build, install, gc
+    bool preflight{true};         // confere disco/memória antes de extract/build/install
+    int preflight_margin_pct{20};
+    bool preflight_mem{true};
+    long preflight_wait{3600};    // segundos máximos de espera com --wait
+    int verify_jobs{4};           // leituras simultâneas no verify-sources
+    fs::path binrepo;             // repositório binário local (package, repo-index, repo-serve)
+    std::string binrepo_url;      // repositório remoto do repo-pull
+    int binrepo_block{2048};      // bloco da assinatura do índice (index.cbpi.zs)
+    int install_jobs{0};          // threads gravando arquivos ao extrair pacotes/snapshots; 0 = núcleos
+    bool install_sync{true};      // um syncfs ao fim de cada extração
+    std::vector<RecipeRepo> repos;   // ordenados por prioridade decrescente
 };
 
+// INI genérico: seção -> chave -> valor (usado pelo cbuild.conf)
+static std::map<std::string, std::map<std::string,std::string>> read_ini(const fs::path &file){
+    std::map<std::string, std::map<std::string,std::string>> out;
+    std::ifstream in(file);
+    std::string line, section;
+    auto trim=[](std::string s){
+        s.erase(0, s.find_first_not_of(" \t\r\n"));
+        s.erase(s.find_last_not_of(" \t\r\n")+1);
+        return s;
+    };
+    while (std::getline(in,line)){
+        line = trim(line);
+        if (line.empty() || line[0]=='#' || line[0]==';') continue;
+        if (line.front()=='[' && line.back()==']'){ section = trim(line.substr(1, line.size()-2)); continue; }
+        auto pos = line.find('=');
+        if (pos==std::string::npos) continue;
+        out[section][trim(line.substr(0,pos))] = trim(line.substr(pos+1));
+    }
+    return out;
+}
+
+// ~/.cbuild/cbuild.conf (opcional):
+//   [logs]
+//   keep=10      # execuções por pacote
+//   max_mb=64    # rotaciona cbuild.log acima disso
+//   rotate=5     # arquivos rotacionados mantidos
+//   [fetch]
+//   probe=1           # corrida até o primeiro byte entre espelhos
+//   probe_timeout=5   # segundos
+//   retries=3  backoff_ms=1000  backoff_max_ms=30000
+//   min_speed=1024  stall_secs=30   # abaixo de min_speed B/s por stall_secs = travado
+//   per_host=2  jobs=4
+//   [git]
+//   jobs=8            # submódulos em paralelo
+//   [outdated]
+//   jobs=16  ttl=21600
+//   [watch]
+//   debounce_ms=300
+//   [binrepo]
+//   dir=~/.cbuild/packages  url=http://host:8080/  block=2048
+//   [install]
+//   jobs=0  sync=1    # extração paralela de pacotes binários e snapshots
+//   [repos]
+//   core=https://example.org/core-recipes.git 10   # <nome>=<url git> [prioridade]
+static void load_config_file(Config &c){
+    auto ini = read_ini(c.base/"cbuild.conf");
+    auto num=[&](const std::string &sec, const std::string &k, long def)->long{
+        auto s = ini.find(sec); if (s==ini.end()) return def;
+        auto v = s->second.find(k); if (v==s->second.end() || v->second.empty()) return def;
+        try { return std::stol(v->second); } catch (...) { return def; }
+    };
+    c.log_keep = (int)num("logs","keep",c.log_keep);
+    c.log_max_mb = (uintmax_t)num("logs","max_mb",(long)c.log_max_mb);
+    c.log_rotate = (int)num("logs","rotate",c.log_rotate);
+    c.mirror_probe = num("fetch","probe",c.mirror_probe)!=0;
+    c.mirror_probe_timeout = (int)num("fetch","probe_timeout",c.mirror_probe_timeout);
+    c.fetch_retries = (int)num("fetch","retries",c.fetch_retries);
+    c.fetch_backoff_ms = (int)num("fetch","backoff_ms",c.fetch_backoff_ms);
+    c.fetch_backoff_max_ms = (int)num("fetch","backoff_max_ms",c.fetch_backoff_max_ms);
+    c.fetch_min_speed = (int)num("fetch","min_speed",c.fetch_min_speed);
+    c.fetch_stall_secs = (int)num("fetch","stall_secs",c.fetch_stall_secs);
+    c.fetch_per_host = std::max(1, (int)num("fetch","per_host",c.fetch_per_host));
+    c.fetch_jobs = std::max(1, (int)num("fetch","jobs",c.fetch_jobs));
+    c.git_jobs = std::max(1, (int)num("git","jobs",c.git_jobs));
+    c.outdated_jobs = std::max(1, (int)num("outdated","jobs",c.outdated_jobs));
+    c.outdated_ttl = num("outdated","ttl",c.outdated_ttl);
+    c.watch_debounce_ms = (int)num("watch","debounce_ms",c.watch_debounce_ms);
+    c.sched_slots = (int)num("sched","slots",c.sched_slots);
+    c.sched_membind = num("sched","membind",c.sched_membind)!=0;
+    c.preflight = num("preflight","enabled",c.preflight)!=0;
+    c.preflight_margin_pct = (int)num("preflight","margin_pct",c.preflight_margin_pct);
+    c.preflight_mem = num("preflight","mem",c.preflight_mem)!=0;
+    c.preflight_wait = num("preflight","wait_secs",c.preflight_wait);
+    c.verify_jobs = std::max(1, (int)num("verify","jobs",c.verify_jobs));
+    if (!ini["binrepo"]["dir"].empty()) c.binrepo = ini["binrepo"]["dir"];
+    c.binrepo_url = ini["binrepo"]["url"];
+    c.binrepo_block = std::clamp((int)num("binrepo","block",c.binrepo_block), 256, 1<<20);
+    c.install_jobs = (int)num("install","jobs",c.install_jobs);
+    c.install_sync = num("install","sync",c.install_sync)!=0;
+    // [priority] classe = "nice [ionice [io.weight]]"; cgroup = pai delegado para io.weight
+    static const std::map<std::string,std::string> prioDefaults = {
+        {"fetch","0"},{"extract","0"},{"build","0"},{"install","0"},{"gc","19 idle"}};
+    auto &pri = ini["priority"];
+    std::string cg = pri.count("cgroup") ? pri["cgroup"] : "";
+    for (auto &d: prioDefaults){
+        PrioClass p = parse_prio(pri.count(d.first) && !pri[d.first].empty() ? pri[d.first] : d.second);
+        if (!cg.empty() && p.weight>0) p.cgroup = (fs::path(cg)/("cbuild-"+d.first)).string();   // criado no primeiro uso
+        c.prio[d.first] = p;
+    }
+    for (auto &kv: ini["repos"]){
+        std::stringstream ss(kv.second); RecipeRepo r; r.name = kv.first;
+        ss >> r.url >> r.priority;
+        if (!r.url.empty()) c.repos.push_back(r);
+    }
+    std::stable_sort(c.repos.begin(), c.repos.end(), [](const RecipeRepo &a, const RecipeRepo &b){ return a.priority > b.priority; });
+}
+
 static Config make_default_config(){
     const char *home = getenv("HOME");
     fs::path base = home ? fs::path(home)/".cbuild" : fs::temp_directory_path()/ "cbuild";
@@ -110,6 +525,8 @@ static Config make_default_config(){
     c.logs = c.base/"logs";
     c.repo = c.base/"repo";
     c.snapshots = c.base/"snapshots";
+    c.binrepo = c.base/"packages";
+    load_config_file(c);
     return c;
 }
 
@@ -131,6 +548,8 @@ static void check_tools(Logger &log, bool strict=true){
 
 struct Recipe {
     std::string name, version, url, sha256, vcs, patches, postremove;
+    std::string depends;   // receitas das quais esta depende (lista separada por vírgula)
+    std::string srcdir;    // fonte local (diretório) sincronizado incrementalmente em work/
     bool strip{false};
     bool submodules{false};
     std::string prebuild, configure, prepare, build, install, postinstall;
@@ -150,19 +569,31 @@ struct Recipe {
         return out;
     }
 
-    static Recipe load(const fs::path &file){
-        Recipe r;
+    // raízes extras para inherit=/include= (recipes/ local e repo/<nome> por prioridade)
+    inline static std::vector<fs::path> search_roots;
+
+    // include=arquivo (relativo à receita ou a recipes/) e inherit=<receita> podem aparecer em
+    // qualquer seção; o conteúdo é lido naquele ponto, então chaves posteriores sobrescrevem, e o
+    // arquivo incluído começa na seção de quem o inclui (um trecho só de [options] não precisa do
+    // cabeçalho). Em absent ficam os caminhos tentados antes do escolhido, que não existiam.
+    static void parse_into(Recipe &r, const fs::path &file, std::vector<fs::path> &deps, int depth=0,
+                           const std::string &startSection="", std::vector<fs::path> *absent=nullptr){
+        if (depth>16) throw std::runtime_error("include/inherit aninhado demais: "+file.string());
         std::ifstream in(file);
         if (!in) throw std::runtime_error("Não foi possível abrir receita: "+file.string());
-        std::string line, section;
+        deps.push_back(file);
+        static const std::regex sectionRx("\\s*\\[.*\\]\\s*");
+        std::string line, section = startSection;
         auto trim=[](std::string s){
             s.erase(0, s.find_first_not_of(" \t\r\n"));
             s.erase(s.find_last_not_of(" \t\r\n")+1);
             return s;
         };
+        // recipes/<nome>/recipe.ini -> recipes/
+        fs::path root = file.parent_path().parent_path();
         while (std::getline(in,line)){
             if (line.size()>0 && (line[0]=='#' || line[0]==';')) continue;
-            if (std::regex_match(line, std::regex("\\s*\\[.*\\]\\s*"))){
+            if (std::regex_match(line, sectionRx)){
                 section = trim(line.substr(line.find('[')+1, line.rfind(']')-line.find('[')-1));
                 continue;
             }
@@ -170,37 +601,233 @@ struct Recipe {
             if (pos==std::string::npos) continue;
             std::string k=trim(line.substr(0,pos));
             std::string v=trim(line.substr(pos+1));
+            if (k=="include" || k=="inherit"){
+                for (auto &item: split_list(v)){
+                    fs::path rel = (k=="inherit") ? fs::path(item)/"recipe.ini" : fs::path(item);
+                    fs::path f = rel;
+                    if (rel.is_relative()){
+                        // ao lado da receita (include), recipes/, repositórios por prioridade
+                        std::vector<fs::path> probe;
+                        if (k=="include") probe.push_back(file.parent_path()/rel);
+                        probe.push_back(root/rel);
+                        for (auto &sr: search_roots) probe.push_back(sr/rel);
+                        f = root/rel;
+                        for (auto &p: probe){
+                            if (fs::exists(p)) { f = p; break; }
+                            if (absent) absent->push_back(p);
+                        }
+                    }
+                    parse_into(r, f, deps, depth+1, section, absent);
+                }
+                continue;
+            }
             if (section=="package"){
-                if(k=="name") r.name=v; else if(k=="version") r.version=v; else if(k=="url") r.url=v;
+                // o nome vem sempre da própria receita, nunca de uma base incluída
+                if(k=="name") { if (depth==0) r.name=v; } else if(k=="version") r.version=v; else if(k=="url") r.url=v;
                 else if(k=="sha256") r.sha256=v; else if(k=="vcs") r.vcs=v; else if(k=="patches") r.patches=v;
                 else if(k=="strip") r.strip=(v=="1"||v=="true"||v=="yes");
                 else if(k=="postremove") r.postremove=v;
                 else if(k=="submodules") r.submodules=(v=="1"||v=="true"||v=="yes");
+                else if(k=="depends") r.depends=v;
+                else if(k=="srcdir") r.srcdir=v;
             } else if (section=="options"){
                 if(k=="prebuild") r.prebuild=v; else if(k=="configure") r.configure=v; else if(k=="prepare") r.prepare=v;
                 else if(k=="build") r.build=v; else if(k=="install") r.install=v; else if(k=="postinstall") r.postinstall=v;
             }
         }
+    }
+
+    static Recipe load(const fs::path &file, std::vector<fs::path> *depsOut=nullptr, std::vector<fs::path> *absentOut=nullptr){
+        Recipe r;
+        std::vector<fs::path> deps;
+        parse_into(r, file, deps, 0, "", absentOut);
         if (r.name.empty()) throw std::runtime_error("Campo [package].name ausente na receita");
         if (r.version.empty()) r.version = "1.0.0";
+        if (depsOut) *depsOut = deps;
+        return r;
+    }
+
+    // campos serializados no cache binário; a contagem entra no cabeçalho do cache
+    std::vector<std::string*> str_fields(){
+        return {&name,&version,&url,&sha256,&vcs,&patches,&postremove,&depends,&srcdir,&prebuild,&configure,&prepare,&build,&install,&postinstall};
+    }
+
+    // impressão digital da receita resolvida; gravada ao instalar para o plan detectar mudanças
+    std::string fingerprint() const {
+        Recipe t = *this;
+        std::string all;
+        for (auto *f: t.str_fields()) { all += *f; all += '\x1f'; }
+        all += char('0'+strip); all += char('0'+submodules);
+        char buf[32]; snprintf(buf, sizeof buf, "%016zx", std::hash<std::string>{}(all));
+        return buf;
+    }
+
+    // Cache binário da receita já resolvida (includes/herança aplicados) em <cacheDir>/<hash>.bin.
+    // Válido enquanto mtime e tamanho de todos os arquivos lidos forem os mesmos e nenhum dos
+    // caminhos de include tentados sem sucesso (gravados com mtime -1) passar a existir.
+    static Recipe load_cached(const fs::path &file, const fs::path &cacheDir, std::vector<fs::path> *depsOut=nullptr){
+        fs::path cf = cacheDir/(std::to_string(std::hash<std::string>{}(fs::absolute(file).string()))+".bin");
+        const uint32_t magic = 0x43425244;   // "CBRD": formato com caminhos ausentes
+        auto stamp=[](const fs::path &p, int64_t &mt, uint64_t &sz){
+            struct stat st{};
+            if (stat(p.c_str(), &st)!=0) return false;
+            mt = (int64_t)st.st_mtim.tv_sec*1000000000LL + st.st_mtim.tv_nsec; sz = (uint64_t)st.st_size;
+            return true;
+        };
+        auto rd_str=[](std::istream &in, std::string &s){
+            uint32_t n=0; in.read((char*)&n, 4); if (!in || n>(1u<<24)) return false;
+            s.resize(n); in.read(s.data(), n); return (bool)in;
+        };
+        Recipe r;
+        {
+            std::ifstream in(cf, std::ios::binary);
+            uint32_t m=0, nf=0, nd=0;
+            in.read((char*)&m,4); in.read((char*)&nf,4); in.read((char*)&nd,4);
+            bool ok = in && m==magic && nf==r.str_fields().size() && nd<1024;
+            std::vector<fs::path> deps;
+            for (uint32_t i=0; ok && i<nd; ++i){
+                std::string p; int64_t mt=0, cmt=0; uint64_t sz=0, csz=0;
+                ok = rd_str(in, p); in.read((char*)&mt,8); in.read((char*)&sz,8);
+                if (mt==-1) { ok = ok && in && !stamp(p, cmt, csz); continue; }
+                ok = ok && in && stamp(p, cmt, csz) && cmt==mt && csz==sz;
+                deps.push_back(p);
+            }
+            for (auto *f: r.str_fields()) ok = ok && rd_str(in, *f);
+            uint8_t b[2]{}; in.read((char*)b, 2);
+            if (ok && in){
+                r.strip=b[0]; r.submodules=b[1];
+                if (depsOut) *depsOut = deps;
+                return r;
+            }
+        }
+        std::vector<fs::path> deps, absent;
+        r = load(file, &deps, &absent);
+        for (auto &d: deps) d = fs::absolute(d);
+        if (depsOut) *depsOut = deps;
+        std::error_code ec;
+        fs::create_directories(cacheDir, ec);
+        fs::path tmp = cf; tmp += ".tmp"+std::to_string(getpid())+"-"+std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+        {
+            std::ofstream out(tmp, std::ios::binary|std::ios::trunc);
+            auto wr_str=[&](const std::string &s){ uint32_t n=s.size(); out.write((char*)&n,4); out.write(s.data(), n); };
+            uint32_t nf = r.str_fields().size(), nd = deps.size()+absent.size();
+            out.write((char*)&magic,4); out.write((char*)&nf,4); out.write((char*)&nd,4);
+            for (auto &d: deps){
+                int64_t mt=0; uint64_t sz=0; stamp(d, mt, sz);
+                wr_str(d.string()); out.write((char*)&mt,8); out.write((char*)&sz,8);
+            }
+            for (auto &a: absent){
+                int64_t mt=-1; uint64_t sz=0;
+                wr_str(fs::absolute(a).string()); out.write((char*)&mt,8); out.write((char*)&sz,8);
+            }
+            for (auto *f: r.str_fields()) wr_str(*f);
+            uint8_t b[2]{(uint8_t)r.strip, (uint8_t)r.submodules}; out.write((char*)b, 2);
+        }
+        fs::rename(tmp, cf, ec);
         return r;
     }
 };
 
-static fs::path recipe_dir(const Config&c, const std::string &name){ return c.recipes/name; }
+// Índice de receitas dos repositórios (cache/index.tsv: repo<TAB>nome). recipes/ local sempre
+// tem precedência; entre repositórios vence a maior prioridade. O sync só reescreve as
+// linhas das receitas que mudaram no diff de cada repositório.
+static fs::path recipe_index_file(const Config&c){ return c.base/"cache"/"index.tsv"; }
+
+static std::map<std::string, std::set<std::string>> read_recipe_index(const Config&c){
+    std::map<std::string, std::set<std::string>> idx;   // repo -> nomes
+    std::ifstream in(recipe_index_file(c)); std::string line;
+    while (std::getline(in,line)){
+        auto tab = line.find('\t');
+        if (tab!=std::string::npos) idx[line.substr(0,tab)].insert(line.substr(tab+1));
+    }
+    return idx;
+}
+
+static void write_recipe_index(const Config&c, const std::map<std::string, std::set<std::string>> &idx){
+    fs::path f = recipe_index_file(c), tmp = f; tmp += ".tmp";
+    fs::create_directories(f.parent_path());
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        for (auto &kv: idx) for (auto &n: kv.second) out << kv.first << '\t' << n << "\n";
+    }
+    fs::rename(tmp, f);
+}
+
+static std::set<std::string> scan_repo_recipes(const fs::path &dir){
+    std::set<std::string> out; std::error_code ec;
+    for (auto &d: fs::directory_iterator(dir, ec))
+        if (d.is_directory() && fs::exists(d.path()/"recipe.ini")) out.insert(d.path().filename().string());
+    return out;
+}
+
+// nome -> diretório vencedor entre os repositórios (carregado uma vez; `reload` relê o índice)
+static const std::map<std::string, fs::path> &repo_recipe_map(const Config&c, bool reload=false){
+    static std::map<std::string, fs::path> m;
+    static std::mutex mtx;
+    static bool loaded = false;
+    std::lock_guard<std::mutex> lk(mtx);
+    if (loaded && !reload) return m;
+    loaded = true;
+    m.clear();
+    if (c.repos.empty()) return m;
+    auto idx = read_recipe_index(c);
+    if (idx.empty()){
+        for (auto &r: c.repos) idx[r.name] = scan_repo_recipes(c.repo/r.name);
+        write_recipe_index(c, idx);
+    }
+    for (auto it=c.repos.rbegin(); it!=c.repos.rend(); ++it)
+        for (auto &n: idx[it->name]) m[n] = c.repo/it->name/n;
+    return m;
+}
+
+static fs::path recipe_dir(const Config&c, const std::string &name){
+    fs::path local = c.recipes/name;
+    if (c.repos.empty() || fs::exists(local/"recipe.ini")) return local;
+    auto &m = repo_recipe_map(c);
+    auto it = m.find(name);
+    return it!=m.end() ? it->second : local;
+}
+static fs::path recipe_cache_dir(const Config&c){ return c.base/"cache"/"recipes"; }
 static fs::path recipe_ini(const Config&c, const std::string &name){ return recipe_dir(c,name)/"recipe.ini"; }
+static std::vector<std::string> list_recipes(const Config&c){
+    std::set<std::string> names = scan_repo_recipes(c.recipes);
+    for (auto &kv: repo_recipe_map(c)) names.insert(kv.first);
+    return {names.begin(), names.end()};
+}
 
 // múltiplos arquivos fonte
+// fonte local: srcdir=/caminho ou url=file:///caminho apontando para um diretório;
+// srcdir= relativo é resolvido a partir do diretório da receita, não do diretório atual
+static fs::path local_source_dir(const Config&c, const Recipe&r){
+    if (!r.srcdir.empty()){
+        fs::path p = r.srcdir;
+        return p.is_relative() ? (recipe_dir(c, r.name)/p).lexically_normal() : p;
+    }
+    for (auto &u: Recipe::split_list(r.url))
+        if (u.rfind("file://",0)==0 && fs::is_directory(u.substr(7))) return u.substr(7);
+    return {};
+}
+
+// entradas de url= que são arquivos a baixar (exclui diretórios locais file://)
+static std::vector<std::string> archive_urls(const Recipe&r){
+    std::vector<std::string> out;
+    for (auto &u: Recipe::split_list(r.url))
+        if (!(u.rfind("file://",0)==0 && fs::is_directory(u.substr(7)))) out.push_back(u);
+    return out;
+}
+
 static std::vector<fs::path> source_paths(const Config&c, const Recipe&r){
     std::vector<fs::path> paths;
-    auto urls = Recipe::split_list(r.url);
+    auto urls = archive_urls(r);
     if (urls.empty()) {
         // se não há url mas há vcs, devolve provável tar fictício
-        if(!r.vcs.empty()) return {};
+        if(!r.vcs.empty() || !local_source_dir(c, r).empty()) return {};
         paths.push_back(c.sources/(r.name+"-"+r.version+".tar"));
         return paths;
     }
-    for (auto &u: urls){
+    for (auto &e: urls){
+        // com espelhos (a|b|c) o nome do arquivo vem do primeiro
+        std::string u = e.substr(0, e.find('|'));
         auto pos = u.find_last_of('/');
         std::string fname = (pos==std::string::npos) ? (r.name+"-"+r.version+".tar.gz") : u.substr(pos+1);
         paths.push_back(c.sources/fname);
@@ -210,6 +837,50 @@ static std::vector<fs::path> source_paths(const Config&c, const Recipe&r){
 static fs::path work_dir(const Config&c, const Recipe&r){ return c.work/(r.name+"-"+r.version); }
 static fs::path destdir_pkg(const Config&c, const Recipe&r){ return c.destroot/(r.name+"-"+r.version); }
 static fs::path install_manifest(const Config&c, const Recipe&r){ return c.logs/(r.name+"-"+r.version+".manifest"); }
+static fs::path sums_file(const Config&c, const Recipe&r){ return c.logs/(r.name+"-"+r.version+".sums"); }
+static fs::path recipe_stamp(const Config&c, const Recipe&r){ return c.logs/(r.name+"-"+r.version+".recipe"); }
+// lixeira: árvores grandes são renomeadas para base/trash (instantâneo) e apagadas por uma thread
+// na classe gc, junto com sobras de execuções anteriores; o processo espera por ela ao sair
+struct TrashReaper {
+    std::mutex m;
+    std::thread t;
+    bool busy{false};
+    void kick(const Config&c){
+        std::lock_guard<std::mutex> lk(m);
+        if (busy) return;
+        if (t.joinable()) t.join();
+        busy = true;
+        t = std::thread([this, dir=c.base/"trash", p=c.prio.at("gc")]{
+            apply_prio(p);
+            for (;;){
+                std::vector<fs::path> items;
+                std::error_code ec;
+                {
+                    std::lock_guard<std::mutex> lk(m);
+                    for (auto &e: fs::directory_iterator(dir, ec)) items.push_back(e.path());
+                    if (items.empty()) { busy = false; return; }
+                }
+                for (auto &i: items) fs::remove_all(i, ec);
+            }
+        });
+    }
+    ~TrashReaper(){ if (t.joinable()) t.join(); }
+};
+static TrashReaper trash_reaper;
+
+static void discard_tree(const Config&c, const fs::path &p){
+    std::error_code ec;
+    if (!fs::exists(p, ec)) return;
+    static std::atomic<int> seq{0};
+    fs::create_directories(c.base/"trash", ec);
+    {
+        std::lock_guard<std::mutex> lk(trash_reaper.m);
+        fs::rename(p, c.base/"trash"/(p.filename().string()+"."+std::to_string(getpid())+"."+std::to_string(seq++)), ec);
+    }
+    if (ec) { fs::remove_all(p, ec); return; }   // outro sistema de arquivos: apaga direto
+    trash_reaper.kick(c);
+}
+
 static fs::path snapshot_tar(const Config&c, const Recipe&r){ return c.snapshots/(r.name+"-"+r.version+".tar.zst"); }
 
 static bool is_elf(const fs::path &p){
@@ -239,20 +910,615 @@ static int cmd_init(const Config&c, const std::string &name, Logger &log){
 static int ensure_recipe(const Config&c, const std::string &name, Recipe &r, Logger &log){
     fs::path ini = recipe_ini(c,name);
     if(!fs::exists(ini)) { log.err("Receita não encontrada: "+ini.string()); return 2; }
-    r = Recipe::load(ini);
+    r = Recipe::load_cached(ini, recipe_cache_dir(c));
     return 0;
 }
 
 // sha256 de um arquivo
-static std::string sha256_file(const fs::path &p){
-    std::string cmd = "sha256sum '" + p.string() + "' | awk '{print $1}'";
-    FILE *f = popen(cmd.c_str(),"r");
-    if (!f) return "";
-    char buf[128]{}; std::string sum;
-    if (fgets(buf,sizeof(buf),f)) sum = buf;
-    pclose(f);
-    sum.erase(std::remove_if(sum.begin(), sum.end(), ::isspace), sum.end());
-    return sum;
+// === SHA-256 ===
+// Implementação própria com escolha em tempo de execução: SHA-NI quando a CPU tem as extensões
+// SHA, senão AVX2 com 8 mensagens por vez (lotes de arquivos pequenos) e, por fim, C portátil.
+// sha256::files distribui os arquivos grandes entre threads e agrupa os pequenos em lotes.
+namespace sha256 {
+
+alignas(64) static const uint32_t K[64] = {
+    0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,
+    0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,0x72be5d74,0x80deb1fe,0x9bdc06a7,0xc19bf174,
+    0xe49b69c1,0xefbe4786,0x0fc19dc6,0x240ca1cc,0x2de92c6f,0x4a7484aa,0x5cb0a9dc,0x76f988da,
+    0x983e5152,0xa831c66d,0xb00327c8,0xbf597fc7,0xc6e00bf3,0xd5a79147,0x06ca6351,0x14292967,
+    0x27b70a85,0x2e1b2138,0x4d2c6dfc,0x53380d13,0x650a7354,0x766a0abb,0x81c2c92e,0x92722c85,
+    0xa2bfe8a1,0xa81a664b,0xc24b8b70,0xc76c51a3,0xd192e819,0xd6990624,0xf40e3585,0x106aa070,
+    0x19a4c116,0x1e376c08,0x2748774c,0x34b0bcb5,0x391c0cb3,0x4ed8aa4a,0x5b9cca4f,0x682e6ff3,
+    0x748f82ee,0x78a5636f,0x84c87814,0x8cc70208,0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2};
+static const uint32_t H0[8] = {0x6a09e667,0xbb67ae85,0x3c6ef372,0xa54ff53a,0x510e527f,0x9b05688c,0x1f83d9ab,0x5be0cd19};
+
+static inline uint32_t rotr(uint32_t x, int n){ return (x>>n) | (x<<(32-n)); }
+static inline uint32_t load_be(const uint8_t *p){ uint32_t v; memcpy(&v, p, 4); return __builtin_bswap32(v); }
+
+static void compress_portable(uint32_t *st, const uint8_t *p, size_t nb){
+    for (; nb--; p+=64){
+        uint32_t w[64];
+        for (int i=0;i<16;++i) w[i] = load_be(p+4*i);
+        for (int i=16;i<64;++i)
+            w[i] = w[i-16] + (rotr(w[i-15],7)^rotr(w[i-15],18)^(w[i-15]>>3)) + w[i-7] + (rotr(w[i-2],17)^rotr(w[i-2],19)^(w[i-2]>>10));
+        uint32_t a=st[0], b=st[1], c=st[2], d=st[3], e=st[4], f=st[5], g=st[6], h=st[7];
+        for (int i=0;i<64;++i){
+            uint32_t t1 = h + (rotr(e,6)^rotr(e,11)^rotr(e,25)) + ((e&f)^(~e&g)) + K[i] + w[i];
+            uint32_t t2 = (rotr(a,2)^rotr(a,13)^rotr(a,22)) + ((a&b)^(a&c)^(b&c));
+            h=g; g=f; f=e; e=d+t1; d=c; c=b; b=a; a=t1+t2;
+        }
+        st[0]+=a; st[1]+=b; st[2]+=c; st[3]+=d; st[4]+=e; st[5]+=f; st[6]+=g; st[7]+=h;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sha,sse4.1,ssse3")))
+static void compress_shani(uint32_t *st, const uint8_t *p, size_t nb){
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&st[0]), 0xB1);   // CDAB
+    __m128i s1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&st[4]), 0x1B);    // EFGH
+    __m128i s0 = _mm_alignr_epi8(tmp, s1, 8);                                          // ABEF
+    s1 = _mm_blend_epi16(s1, tmp, 0xF0);                                               // CDGH
+    for (; nb--; p+=64){
+        __m128i save0 = s0, save1 = s1, m[4];
+        for (int i=0;i<16;++i){
+            __m128i &cur = m[i&3];
+            if (i<4) cur = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p+16*i)), MASK);
+            else {
+                // W[t] = σ1(W[t-2]) + W[t-7] + σ0(W[t-15]) + W[t-16], 4 palavras por vez
+                cur = _mm_sha256msg1_epu32(cur, m[(i-3)&3]);
+                cur = _mm_add_epi32(cur, _mm_alignr_epi8(m[(i-1)&3], m[(i-2)&3], 4));
+                cur = _mm_sha256msg2_epu32(cur, m[(i-1)&3]);
+            }
+            __m128i msg = _mm_add_epi32(cur, _mm_load_si128((const __m128i*)&K[4*i]));
+            s1 = _mm_sha256rnds2_epu32(s1, s0, msg);
+            s0 = _mm_sha256rnds2_epu32(s0, s1, _mm_shuffle_epi32(msg, 0x0E));
+        }
+        s0 = _mm_add_epi32(s0, save0);
+        s1 = _mm_add_epi32(s1, save1);
+    }
+    tmp = _mm_shuffle_epi32(s0, 0x1B);     // FEBA
+    s1 = _mm_shuffle_epi32(s1, 0xB1);      // DCHG
+    _mm_storeu_si128((__m128i*)&st[0], _mm_blend_epi16(tmp, s1, 0xF0));   // DCBA
+    _mm_storeu_si128((__m128i*)&st[4], _mm_alignr_epi8(s1, tmp, 8));      // HGFE
+}
+
+__attribute__((target("avx2")))
+static inline __m256i rot(__m256i x, int n){ return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32-n)); }
+
+// um bloco de 64 bytes para cada uma das 8 mensagens; st[palavra][mensagem]
+__attribute__((target("avx2")))
+static void compress_x8(uint32_t st[8][8], const uint8_t *const blk[8]){
+    __m256i w[64];
+    for (int i=0;i<16;++i)
+        w[i] = _mm256_setr_epi32(load_be(blk[0]+4*i), load_be(blk[1]+4*i), load_be(blk[2]+4*i), load_be(blk[3]+4*i),
+                                 load_be(blk[4]+4*i), load_be(blk[5]+4*i), load_be(blk[6]+4*i), load_be(blk[7]+4*i));
+    for (int i=16;i<64;++i){
+        __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(rot(w[i-15],7), rot(w[i-15],18)), _mm256_srli_epi32(w[i-15],3));
+        __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(rot(w[i-2],17), rot(w[i-2],19)), _mm256_srli_epi32(w[i-2],10));
+        w[i] = _mm256_add_epi32(_mm256_add_epi32(w[i-16], s0), _mm256_add_epi32(w[i-7], s1));
+    }
+    __m256i v[8];
+    for (int j=0;j<8;++j) v[j] = _mm256_loadu_si256((const __m256i*)st[j]);
+    __m256i a=v[0], b=v[1], c=v[2], d=v[3], e=v[4], f=v[5], g=v[6], h=v[7];
+    for (int i=0;i<64;++i){
+        __m256i S1 = _mm256_xor_si256(_mm256_xor_si256(rot(e,6), rot(e,11)), rot(e,25));
+        __m256i ch = _mm256_xor_si256(_mm256_and_si256(e,f), _mm256_andnot_si256(e,g));
+        __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, S1), _mm256_add_epi32(ch, _mm256_add_epi32(_mm256_set1_epi32(K[i]), w[i])));
+        __m256i S0 = _mm256_xor_si256(_mm256_xor_si256(rot(a,2), rot(a,13)), rot(a,22));
+        __m256i mj = _mm256_xor_si256(_mm256_xor_si256(_mm256_and_si256(a,b), _mm256_and_si256(a,c)), _mm256_and_si256(b,c));
+        h=g; g=f; f=e; e=_mm256_add_epi32(d, t1); d=c; c=b; b=a; a=_mm256_add_epi32(t1, _mm256_add_epi32(S0, mj));
+    }
+    __m256i out[8] = {a,b,c,d,e,f,g,h};
+    for (int j=0;j<8;++j) _mm256_storeu_si256((__m256i*)st[j], _mm256_add_epi32(v[j], out[j]));
+}
+#endif
+
+using CompressFn = void(*)(uint32_t*, const uint8_t*, size_t);
+static CompressFn compress(){
+#if defined(__x86_64__) || defined(__i386__)
+    static const CompressFn f = (__builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1")) ? compress_shani : compress_portable;
+    return f;
+#else
+    return compress_portable;
+#endif
+}
+// multi-buffer só compensa sem SHA-NI (uma via SHA-NI já supera 8 vias AVX2)
+static bool use_x8(){
+#if defined(__x86_64__) || defined(__i386__)
+    static const bool b = compress()==compress_portable && __builtin_cpu_supports("avx2");
+    return b;
+#else
+    return false;
+#endif
+}
+static const char *engine(){ return compress()!=compress_portable ? "sha-ni" : use_x8() ? "avx2-x8" : "portátil"; }
+
+static std::string hex(const uint32_t st[8]){
+    static const char *dig = "0123456789abcdef";
+    std::string s(64, '0');
+    for (int i=0;i<32;++i){ uint8_t b = st[i/4] >> (24-8*(i%4)); s[2*i]=dig[b>>4]; s[2*i+1]=dig[b&15]; }
+    return s;
+}
+
+struct Ctx {
+    uint32_t h[8];
+    uint8_t buf[64];
+    size_t n{0};
+    uint64_t len{0};
+    Ctx(){ memcpy(h, H0, sizeof h); }
+    void update(const uint8_t *p, size_t sz){
+        len += sz;
+        if (n){
+            size_t k = std::min(sz, 64-n);
+            memcpy(buf+n, p, k); n += k; p += k; sz -= k;
+            if (n<64) return;
+            compress()(h, buf, 1); n = 0;
+        }
+        if (sz>=64) { compress()(h, p, sz/64); p += sz&~(size_t)63; sz &= 63; }
+        memcpy(buf, p, sz); n = sz;
+    }
+    std::string final(){
+        uint64_t bits = len*8;
+        uint8_t pad[72]{0x80};
+        size_t padLen = (n<56 ? 56-n : 120-n);
+        for (int i=0;i<8;++i) pad[padLen+i] = bits >> (56-8*i);
+        update(pad, padLen+8);
+        return hex(h);
+    }
+};
+
+// mensagem completa já com o padding (para os lotes multi-buffer)
+static std::vector<uint8_t> padded(std::vector<uint8_t> m){
+    uint64_t bits = (uint64_t)m.size()*8;
+    m.push_back(0x80);
+    while (m.size()%64!=56) m.push_back(0);
+    for (int i=0;i<8;++i) m.push_back(bits >> (56-8*i));
+    return m;
+}
+
+static bool read_all(const fs::path &p, std::vector<uint8_t> &out){
+    int fd = open(p.c_str(), O_RDONLY|O_CLOEXEC);
+    if (fd<0) return false;
+    struct stat st{};
+    fstat(fd, &st);
+    out.resize(st.st_size);
+    size_t got = 0;
+    for (ssize_t r; got<out.size() && (r = read(fd, out.data()+got, out.size()-got))>0; ) got += r;
+    close(fd);
+    out.resize(got);
+    return true;
+}
+
+static std::string str(const std::string &s){
+    Ctx ctx;
+    ctx.update((const uint8_t*)s.data(), s.size());
+    return ctx.final();
+}
+
+// "" se não der para ler
+static std::string file(const fs::path &p){
+    int fd = open(p.c_str(), O_RDONLY|O_CLOEXEC);
+    if (fd<0) return "";
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    Ctx ctx;
+    std::vector<uint8_t> buf(1<<20);
+    ssize_t r;
+    while ((r = read(fd, buf.data(), buf.size()))>0) ctx.update(buf.data(), r);
+    close(fd);
+    return r<0 ? "" : ctx.final();
+}
+
+// até 8 arquivos pequenos de uma vez, cada um numa via do AVX2
+static void files_x8(const std::vector<fs::path> &paths, const size_t *idx, size_t cnt, std::vector<std::string> &out){
+#if defined(__x86_64__) || defined(__i386__)
+    static const uint8_t zero[64]{};
+    std::vector<uint8_t> msg[8];
+    size_t nb[8]{}, maxb = 0;
+    uint32_t st[8][8];
+    for (int w=0;w<8;++w) for (int l=0;l<8;++l) st[w][l] = H0[w];
+    for (size_t l=0;l<cnt;++l){
+        if (!read_all(paths[idx[l]], msg[l])) { nb[l] = 0; continue; }
+        msg[l] = padded(std::move(msg[l]));
+        nb[l] = msg[l].size()/64;
+        maxb = std::max(maxb, nb[l]);
+    }
+    for (size_t b=0;b<maxb;++b){
+        const uint8_t *blk[8];
+        for (int l=0;l<8;++l) blk[l] = (size_t)l<cnt && b<nb[l] ? msg[l].data()+64*b : zero;
+        compress_x8(st, blk);
+        for (size_t l=0;l<cnt;++l) if (b+1==nb[l]){
+            uint32_t h[8];
+            for (int w=0;w<8;++w) h[w] = st[w][l];
+            out[idx[l]] = hex(h);
+        }
+    }
+#endif
+}
+
+// hash de muitos arquivos: grandes um por thread, pequenos em lotes de 8 (AVX2) quando compensa
+static std::vector<std::string> files(const std::vector<fs::path> &paths, int threads=0){
+    std::vector<std::string> out(paths.size());
+    const uintmax_t small = 64*1024;
+    std::vector<std::pair<uintmax_t,size_t>> bySize;
+    for (size_t i=0;i<paths.size();++i){ std::error_code ec; bySize.push_back({fs::file_size(paths[i], ec), i}); }
+    // maiores primeiro (equilibra as threads); pequenos de tamanho parecido juntos no mesmo lote
+    std::sort(bySize.begin(), bySize.end(), std::greater<>());
+    std::vector<std::vector<size_t>> tasks;
+    bool lastSmall = false;
+    for (auto &bs: bySize){
+        bool batch = use_x8() && bs.first<small;
+        if (batch && lastSmall && tasks.back().size()<8) tasks.back().push_back(bs.second);
+        else { tasks.push_back({bs.second}); lastSmall = batch; }
+    }
+    if (threads<=0) threads = std::max(1u, std::thread::hardware_concurrency());
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> pool;
+    for (int t=0; t<std::min<int>(threads, (int)tasks.size()); ++t)
+        pool.emplace_back([&]{
+            for (size_t i; (i=next++)<tasks.size(); ){
+                if (tasks[i].size()>1) files_x8(paths, tasks[i].data(), tasks[i].size(), out);
+                else out[tasks[i][0]] = file(paths[tasks[i][0]]);
+            }
+        });
+    for (auto &t: pool) t.join();
+    return out;
+}
+}
+
+static std::string sha256_file(const fs::path &p){ return sha256::file(p); }
+
+// === Espelhos ===
+// Cada entrada de url= pode listar espelhos do mesmo arquivo separados por '|':
+//   url=https://ftp.gnu.org/gnu/hello/hello-2.12.tar.gz|https://mirrors.kernel.org/gnu/hello/hello-2.12.tar.gz
+// Antes de baixar, os espelhos são ordenados pela latência medida agora (em paralelo) e pelo
+// histórico de latência/vazão em base/mirrors.tsv; se um falhar, passa para o próximo.
+static std::vector<std::string> split_mirrors(const std::string &entry){
+    std::vector<std::string> out;
+    std::stringstream ss(entry); std::string m;
+    while (std::getline(ss, m, '|')){
+        m.erase(0, m.find_first_not_of(" \t"));
+        m.erase(m.find_last_not_of(" \t")+1);
+        if (!m.empty()) out.push_back(m);
+    }
+    return out;
+}
+
+static std::string url_host(const std::string &u){
+    auto p = u.find("://");
+    if (p==std::string::npos) return u;
+    auto e = u.find('/', p+3);
+    return u.substr(0, e);
+}
+
+struct MirrorStat { double latency_ms{0}, speed_bps{0}; int fails{0}; long updated{0}; };
+
+static fs::path mirror_stats_file(const Config&c){ return c.base/"mirrors.tsv"; }
+
+static std::map<std::string,MirrorStat> load_mirror_stats(const Config&c){
+    std::map<std::string,MirrorStat> m;
+    std::ifstream in(mirror_stats_file(c)); std::string line;
+    while (std::getline(in,line)){
+        std::stringstream ss(line); std::string host; MirrorStat st;
+        if (std::getline(ss, host, '\t') && ss >> st.latency_ms >> st.speed_bps >> st.fails >> st.updated) m[host]=st;
+    }
+    return m;
+}
+
+// média móvel exponencial; leitura+escrita sob flock para vários cbuild simultâneos
+static void update_mirror_stat(const Config&c, const std::string &host, double ttfb_ms, double speed_bps, bool ok){
+    fs::path f = mirror_stats_file(c);
+    int fd = open((f.string()+".lock").c_str(), O_CREAT|O_RDWR, 0644);
+    if (fd>=0) flock(fd, LOCK_EX);
+    auto m = load_mirror_stats(c);
+    auto &st = m[host];
+    const double a = 0.3;
+    if (ok){
+        st.latency_ms = st.latency_ms>0 ? (1-a)*st.latency_ms + a*ttfb_ms : ttfb_ms;
+        st.speed_bps  = st.speed_bps>0  ? (1-a)*st.speed_bps  + a*speed_bps : speed_bps;
+        st.fails = 0;
+    } else st.fails++;
+    st.updated = (long)time(nullptr);
+    fs::path tmp = f; tmp += ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        for (auto &kv: m) out << kv.first << '\t' << kv.second.latency_ms << '\t' << kv.second.speed_bps
+                              << '\t' << kv.second.fails << '\t' << kv.second.updated << "\n";
+    }
+    std::error_code ec; fs::rename(tmp, f, ec);
+    if (fd>=0) { flock(fd, LOCK_UN); close(fd); }
+}
+
+// tempo até o primeiro byte (ms), ou <0 se o espelho não respondeu
+static double probe_ttfb(const std::string &url, int timeout){
+    std::string cmd = "curl -sS -L --fail -o /dev/null -r 0-0 --max-time "+std::to_string(timeout)
+                    + " -w '%{time_starttransfer}' '"+url+"' 2>/dev/null";
+    FILE *p = popen(cmd.c_str(), "r"); if (!p) return -1;
+    char buf[64]{}; std::string out;
+    while (fgets(buf, sizeof buf, p)) out += buf;
+    int rc = pclose(p);
+    if (rc!=0 || out.empty()) return -1;
+    try { return std::stod(out)*1000.0; } catch (...) { return -1; }
+}
+
+static std::vector<std::string> rank_mirrors(const Config&c, const std::vector<std::string> &mirrors, Logger &log){
+    if (mirrors.size()<2) return mirrors;
+    auto stats = load_mirror_stats(c);
+    std::vector<double> ttfb(mirrors.size(), -1);
+    if (c.mirror_probe){
+        std::vector<std::thread> th;
+        for (size_t i=0;i<mirrors.size();++i)
+            th.emplace_back([&,i]{ ttfb[i] = probe_ttfb(mirrors[i], c.mirror_probe_timeout); });
+        for (auto &t: th) t.join();
+    }
+    // custo estimado (ms) de baixar 8 MiB: latência (medida agora ou histórica) + tempo de transferência
+    std::vector<std::pair<double,size_t>> score;
+    for (size_t i=0;i<mirrors.size();++i){
+        auto it = stats.find(url_host(mirrors[i]));
+        double lat = ttfb[i]>=0 ? ttfb[i] : (it!=stats.end() && it->second.latency_ms>0 ? it->second.latency_ms : 1e6);
+        if (c.mirror_probe && ttfb[i]<0) lat = 1e9;
+        double xfer = (it!=stats.end() && it->second.speed_bps>0) ? 8.0*1024*1024/it->second.speed_bps*1000.0 : 0;
+        double pen = it!=stats.end() ? it->second.fails*5000.0 : 0;
+        score.push_back({lat+xfer+pen, i});
+    }
+    std::stable_sort(score.begin(), score.end());
+    std::vector<std::string> out;
+    for (auto &s: score){
+        out.push_back(mirrors[s.second]);
+        log.info("espelho "+url_host(mirrors[s.second])+" custo≈"+std::to_string((long)s.first)+"ms");
+    }
+    return out;
+}
+
+// trava de conexão por host: até per_host arquivos base/locks/<host>.<i> presos com flock,
+// o que limita downloads simultâneos no mesmo host entre threads e entre processos cbuild
+struct HostSlot {
+    int fd{-1};
+    HostSlot(const Config&c, const std::string &host){
+        std::string key = host;
+        for (auto &ch: key) if (!isalnum((unsigned char)ch) && ch!='.' && ch!='-') ch='_';
+        fs::create_directories(c.base/"locks");
+        for (;;){
+            for (int i=0;i<c.fetch_per_host;++i){
+                int f = open((c.base/"locks"/(key+"."+std::to_string(i))).c_str(), O_CREAT|O_RDWR, 0644);
+                if (f<0) continue;
+                if (flock(f, LOCK_EX|LOCK_NB)==0) { fd=f; return; }
+                close(f);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+    ~HostSlot(){ if (fd>=0) { flock(fd, LOCK_UN); close(fd); } }
+};
+
+// === posicionamento de builds concorrentes (afinidade de CPU / NUMA) ===
+// Com [sched] slots=N cada processo de build pega um slot livre (locks/cpu.<i>) e fica preso às
+// CPUs daquela fatia da máquina; -1 = um slot por nó NUMA. Filhos herdam a afinidade, e make
+// recebe -j do tamanho da fatia se MAKEFLAGS não estiver definido.
+static std::vector<int> parse_cpulist(const std::string &s){
+    std::vector<int> out;
+    std::stringstream ss(s); std::string part;
+    while (std::getline(ss, part, ',')){
+        int a=0, b=0;
+        int n = sscanf(part.c_str(), "%d-%d", &a, &b);
+        if (n==1) b = a;
+        if (n>=1) for (int i=a;i<=b;++i) out.push_back(i);
+    }
+    return out;
+}
+
+struct CpuSet { std::vector<int> cpus, nodes; };
+
+static std::vector<CpuSet> cpu_slots(int slots){
+    cpu_set_t allowed; CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof allowed, &allowed);
+    std::vector<CpuSet> nodes;
+    std::error_code ec;
+    for (auto &e: fs::directory_iterator("/sys/devices/system/node", ec)){
+        std::string d = e.path().filename().string();
+        if (d.rfind("node",0)!=0 || d.size()<5 || !isdigit((unsigned char)d[4])) continue;
+        std::ifstream in(e.path()/"cpulist");
+        std::string l; std::getline(in, l);
+        CpuSet cs; cs.nodes = {std::atoi(d.c_str()+4)};
+        for (int cpu: parse_cpulist(l)) if (CPU_ISSET(cpu, &allowed)) cs.cpus.push_back(cpu);
+        if (!cs.cpus.empty()) nodes.push_back(cs);
+    }
+    std::sort(nodes.begin(), nodes.end(), [](const CpuSet &a, const CpuSet &b){ return a.nodes < b.nodes; });
+    if (nodes.empty()){
+        CpuSet cs;
+        for (int cpu=0; cpu<CPU_SETSIZE; ++cpu) if (CPU_ISSET(cpu, &allowed)) cs.cpus.push_back(cpu);
+        nodes.push_back(cs);
+    }
+    if (slots<0) slots = nodes.size();
+    std::vector<CpuSet> out(slots);
+    if ((size_t)slots<=nodes.size()){
+        // nós inteiros distribuídos entre os slots
+        for (size_t i=0;i<nodes.size();++i){
+            auto &o = out[i%slots];
+            o.cpus.insert(o.cpus.end(), nodes[i].cpus.begin(), nodes[i].cpus.end());
+            o.nodes.insert(o.nodes.end(), nodes[i].nodes.begin(), nodes[i].nodes.end());
+        }
+    } else {
+        // mais slots que nós: cada nó é fatiado, nunca cruzando a fronteira entre nós
+        size_t s = 0;
+        for (size_t i=0;i<nodes.size();++i){
+            size_t k = slots/nodes.size() + (i < slots%nodes.size());
+            auto &cp = nodes[i].cpus;
+            for (size_t j=0;j<k;++j,++s){
+                size_t a = cp.size()*j/k, b = std::max(a+1, cp.size()*(j+1)/k);
+                out[s].cpus.assign(cp.begin()+std::min(a, cp.size()-1), cp.begin()+std::min(b, cp.size()));
+                out[s].nodes = nodes[i].nodes;
+            }
+        }
+    }
+    return out;
+}
+
+struct CpuSlot {
+    int fd{-1};
+    std::string desc;
+    // pega um slot livre e aplica ao processo; sem slot livre o build segue sem fixação
+    void apply(const Config&c, Logger &log){
+        if (c.sched_slots==0) return;
+        if (fd<0 && desc.empty()){
+            auto slots = cpu_slots(c.sched_slots);
+            fs::create_directories(c.base/"locks");
+            for (size_t i=0;i<slots.size() && fd<0;++i){
+                int f = open((c.base/"locks"/("cpu."+std::to_string(i))).c_str(), O_CREAT|O_RDWR|O_CLOEXEC, 0644);
+                if (f<0) continue;
+                if (flock(f, LOCK_EX|LOCK_NB)!=0) { close(f); continue; }
+                fd = f;
+                cpu_set_t set; CPU_ZERO(&set);
+                for (int cpu: slots[i].cpus) CPU_SET(cpu, &set);
+                if (sched_setaffinity(0, sizeof set, &set)!=0) { desc = std::string("sched_setaffinity falhou: ")+strerror(errno); break; }
+                std::string cl, nl;
+                for (int cpu: slots[i].cpus) cl += (cl.empty()?"":",") + std::to_string(cpu);
+                for (int n: slots[i].nodes) nl += (nl.empty()?"":",") + std::to_string(n);
+                if (c.sched_membind && !slots[i].nodes.empty()){
+                    unsigned long mask = 0;
+                    for (int n: slots[i].nodes) if (n < (int)(8*sizeof mask)) mask |= 1UL<<n;
+                    if (syscall(SYS_set_mempolicy, MPOL_BIND, &mask, 8*sizeof mask)!=0) nl += " (membind falhou)";
+                    else nl += " (membind)";
+                }
+                int jobs = slots[i].cpus.size();
+                if (!getenv("MAKEFLAGS")) setenv("MAKEFLAGS", ("-j"+std::to_string(jobs)).c_str(), 1);
+                setenv("CBUILD_JOBS", std::to_string(jobs).c_str(), 1);
+                desc = "slot "+std::to_string(i+1)+"/"+std::to_string(slots.size())+", CPUs "+cl+
+                       (nl.empty() ? "" : ", nó "+nl)+", -j"+std::to_string(jobs);
+            }
+            if (desc.empty()) desc = "todos os "+std::to_string(slots.size())+" slots ocupados, sem fixação";
+        }
+        log.info("Posicionamento: "+desc);
+    }
+    ~CpuSlot(){ if (fd>=0) { flock(fd, LOCK_UN); close(fd); } }
+};
+
+static void backoff_sleep(const Config&c, int attempt){
+    static thread_local std::mt19937 rng(std::random_device{}());
+    long cap = std::min<long>(c.fetch_backoff_max_ms, (long)c.fetch_backoff_ms << std::min(attempt, 20));
+    // jitter: espera entre 50% e 100% do teto, para não sincronizar novas tentativas
+    long ms = cap/2 + std::uniform_int_distribution<long>(0, std::max(0L, cap/2))(rng);
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+// baixa para <dst>.part e renomeia; tenta os espelhos em ordem e repete com backoff.
+// Transferência abaixo de min_speed por stall_secs é abortada pelo curl (rc=28) e retomada com -C -.
+// Com `sum`, o sha256 é calculado durante o download (curl | tee | sha256sum), sem retomar.
+static int fetch_with_mirrors(const Config&c, const std::string &entry, const fs::path &dst, Logger &log,
+                              std::string *sum=nullptr){
+    auto mirrors = rank_mirrors(c, split_mirrors(entry), log);
+    fs::path part = dst; part += ".part";
+    int rc = 1;
+    for (int attempt=0; attempt<=c.fetch_retries; ++attempt){
+        if (attempt>0){
+            log.warn("Nova tentativa "+std::to_string(attempt)+"/"+std::to_string(c.fetch_retries)+": "+dst.filename().string());
+            backoff_sleep(c, attempt-1);
+        }
+        for (auto &m: mirrors){
+            std::string out;
+            std::string curl = "curl -sS -L --fail --speed-limit "+std::to_string(c.fetch_min_speed)
+                             + " --speed-time "+std::to_string(c.fetch_stall_secs)
+                             + " -w '%{stderr}\\nCBSTAT %{time_starttransfer} %{speed_download}\\n'";
+            {
+                HostSlot slot(c, url_host(m));
+                if (sum) rc = exec_cmd("bash -c \"set -o pipefail; "+curl+" '"+m+"' | tee '"+part.string()+"' | sha256sum\"", log, false, &out);
+                else rc = exec_cmd(curl+" -C - -o '"+part.string()+"' '"+m+"'", log, true, &out);
+            }
+            double ttfb=0, speed=0;
+            std::stringstream lines(out); std::string line;
+            while (std::getline(lines, line)){
+                if (line.rfind("CBSTAT ",0)==0) std::stringstream(line.substr(7)) >> ttfb >> speed;
+                else if (sum && line.size()>=64 && line.find_first_not_of("0123456789abcdef")>=64) *sum = line.substr(0,64);
+            }
+            update_mirror_stat(c, url_host(m), ttfb*1000.0, speed, rc==0);
+            if (rc==0){
+                fs::rename(part, dst);
+                return 0;
+            }
+            std::error_code ec;
+            if (sum) fs::remove(part, ec);   // download com hash em fluxo não retoma
+            if (rc==28) log.warn("Transferência travada em "+url_host(m)+" (abaixo de "+std::to_string(c.fetch_min_speed)+" B/s)");
+            else if (rc==33 || rc==22 || rc==36){
+                // servidor não aceita retomar: recomeça do zero
+                uintmax_t had = fs::file_size(part, ec);
+                log.warn("Falha no espelho "+url_host(m)+" (rc="+std::to_string(rc)+")"+
+                         (!ec && had ? "; retomada recusada, descartando "+std::to_string(had)+" bytes já baixados" : ""));
+                fs::remove(part, ec);
+            }
+            else log.warn("Falha no espelho "+url_host(m)+" (rc="+std::to_string(rc)+")");
+        }
+    }
+    return rc;
+}
+
+// === Submódulos ===
+// Cada URL de submódulo tem um espelho bare em sources/git-cache/, atualizado em paralelo
+// (até git_jobs). O checkout dos submódulos sai desse cache local, então receitas que
+// compartilham submódulos não baixam os mesmos objetos de novo e o extract não usa rede.
+static fs::path git_cache_dir(const Config&c, const std::string &url){
+    std::string key = url;
+    for (auto &ch: key) if (!isalnum((unsigned char)ch) && ch!='.' && ch!='-') ch='_';
+    return c.sources/"git-cache"/(key+".git");
+}
+
+static std::vector<std::pair<std::string,std::string>> submodule_urls(const fs::path &repo){
+    std::vector<std::pair<std::string,std::string>> out;
+    // -z: "chave\nvalor\0", porque o nome do submódulo (por padrão o caminho) pode ter espaços
+    std::string cmd = "git -C '"+repo.string()+"' config -z --get-regexp '^submodule\\..*\\.url$' 2>/dev/null";
+    FILE *p = popen(cmd.c_str(), "r"); if (!p) return out;
+    std::string all; char buf[4096]; size_t n;
+    while ((n = fread(buf, 1, sizeof buf, p))>0) all.append(buf, n);
+    pclose(p);
+    std::stringstream ss(all);
+    for (std::string ent; std::getline(ss, ent, '\0'); ){
+        auto nl = ent.find('\n');
+        if (nl==std::string::npos || nl<14) continue;
+        out.push_back({ent.substr(10, nl-10-4), ent.substr(nl+1)});   // submodule.<nome>.url
+    }
+    return out;
+}
+
+static int update_submodules(const Config&c, const fs::path &repo, Logger &log, int depth=0){
+    if (!fs::exists(repo/".gitmodules") || depth>8) return 0;
+    std::string g = "git -C '"+repo.string()+"' ";
+    exec_cmd(g+"submodule sync", log);
+    int rc = exec_cmd(g+"submodule init", log); if (rc) return rc;
+    auto subs = submodule_urls(repo);
+    // URLs que já apontam para o cache (execução anterior) não precisam ser trocadas de novo
+    std::vector<std::pair<std::string,std::string>> remote;
+    for (auto &s: subs) if (s.second.rfind((c.sources/"git-cache").string(),0)!=0) remote.push_back(s);
+
+    fs::create_directories(c.sources/"git-cache");
+    std::vector<int> rcs(remote.size(), 0);
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> pool;
+    for (int j=0; j<std::min<int>(c.git_jobs, (int)remote.size()); ++j)
+        pool.emplace_back([&]{
+            for (size_t i; (i=next++)<remote.size(); ){
+                // o cache é compartilhado entre receitas (e processos): um clone/fetch por vez
+                fs::path cache = git_cache_dir(c, remote[i].second);
+                int fd = open((cache.string()+".lock").c_str(), O_CREAT|O_RDWR, 0644);
+                if (fd>=0) flock(fd, LOCK_EX);
+                rcs[i] = fs::exists(cache)
+                    ? exec_cmd("git -C '"+cache.string()+"' fetch --prune --tags origin '+refs/*:refs/*'", log, false)
+                    : exec_cmd("git clone --mirror '"+remote[i].second+"' '"+cache.string()+"'", log, false);
+                if (fd>=0) { flock(fd, LOCK_UN); close(fd); }
+            }
+        });
+    for (auto &t: pool) t.join();
+    for (size_t i=0;i<remote.size();++i){
+        if (rcs[i]) { log.err("Falha ao buscar submódulo "+remote[i].first+": "+remote[i].second); return rcs[i]; }
+        exec_cmd(g+"config 'submodule."+remote[i].first+".url' '"+git_cache_dir(c, remote[i].second).string()+"'", log, false);
+    }
+    rc = exec_cmd(g+"-c protocol.file.allow=always submodule update --init --jobs "+std::to_string(c.git_jobs), log);
+    if (rc) return rc;
+    // submódulos aninhados: mesmo processo dentro de cada submódulo ($sm_path preserva espaços)
+    std::string cmd = g+"submodule foreach --quiet 'printf \"%s\\n\" \"$sm_path\"' 2>/dev/null";
+    FILE *p = popen(cmd.c_str(), "r"); char buf[4096]; std::vector<fs::path> paths;
+    while (p && fgets(buf, sizeof buf, p)){ std::string s(buf); s.erase(s.find_last_not_of("\r\n")+1); paths.push_back(repo/s); }
+    if (p) pclose(p);
+    for (auto &sp: paths){ rc = update_submodules(c, sp, log, depth+1); if (rc) return rc; }
+    return 0;
 }
 
 static int cmd_fetch(const Config&c, const Recipe&r, Logger &log){
@@ -261,14 +1527,25 @@ static int cmd_fetch(const Config&c, const Recipe&r, Logger &log){
     int rc=0; Spinner sp; sp.start("baixa ");
 
     // múltiplos tarballs
-    auto urls = Recipe::split_list(r.url);
+    auto urls = archive_urls(r);
     auto sums = Recipe::split_list(r.sha256);
+    auto dsts = source_paths(c,r);
+    // downloads em paralelo (até fetch_jobs), verificação depois
+    std::vector<int> rcs(urls.size(), 0);
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> pool;
+    for (int j=0; j<std::min<int>(c.fetch_jobs, (int)urls.size()); ++j)
+        pool.emplace_back([&, pre=cmd_prefix]{
+            cmd_prefix = pre;
+            for (size_t i; (i=next++)<urls.size(); ){
+                if (!fs::exists(dsts[i])) rcs[i] = fetch_with_mirrors(c, urls[i], dsts[i], log);
+                else log.info("Fonte já presente: "+dsts[i].string());
+            }
+        });
+    for (auto &t: pool) t.join();
     for (size_t i=0;i<urls.size();++i){
-        fs::path dst = source_paths(c,r).at(i);
-        if (!fs::exists(dst)){
-            rc = exec_cmd("curl -L --fail -o '" + dst.string() + "' '" + urls[i] + "'", log);
-            if (rc) return rc;
-        } else log.info("Fonte já presente: "+dst.string());
+        fs::path dst = dsts[i];
+        if (rcs[i]) { log.err("Falha ao baixar: "+urls[i]); return rcs[i]; }
         if (i < sums.size() && !sums[i].empty()){
             auto got = sha256_file(dst);
             if (got!=sums[i]){ log.err("sha256 diferente: "+got+" != "+sums[i]); return 3; }
@@ -281,11 +1558,9 @@ static int cmd_fetch(const Config&c, const Recipe&r, Logger &log){
         std::string url = r.vcs.substr(4);
         fs::path d = c.sources/(r.name+"-git");
         if (!fs::exists(d)) rc = exec_cmd("git clone '"+url+"' '"+d.string()+"'", log);
-        else {
-            rc = exec_cmd("git -C '"+d.string()+"' fetch --all --tags", log);
-            if (r.submodules) exec_cmd("git -C '"+d.string()+"' submodule update --init --recursive", log);
-        }
+        else rc = exec_cmd("git -C '"+d.string()+"' fetch --all --tags", log);
         if (rc) return rc;
+        if (r.submodules) { rc = update_submodules(c, d, log); if (rc) return rc; }
     }
 
     sp.stop();
@@ -303,10 +1578,108 @@ static int extract_one(const fs::path &src, const fs::path &dst, Logger &log){
     return exec_cmd("tar -xf '"+s+"' -C '"+dst.string()+"' --strip-components=1", log);
 }
 
+// Sincroniza um diretório local em work/ como o rsync: copia só arquivos cuja mtime ou tamanho
+// mudou (reflink quando o sistema de arquivos permite), preserva mtime/modo e remove apenas o que
+// veio da fonte numa sincronização anterior (lista em .cbuild-srcsync). Artefatos de build ficam.
+struct SyncStats { size_t copied{0}, same{0}, removed{0}; uintmax_t bytes{0}; };
+
+static bool clone_or_copy(const fs::path &src, const fs::path &dst, const struct stat &st){
+    int in = open(src.c_str(), O_RDONLY|O_CLOEXEC);
+    if (in<0) return false;
+    fs::path tmp = dst; tmp += ".cbuild-tmp";
+    int out = open(tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, st.st_mode & 07777);
+    if (out<0) { close(in); return false; }
+    bool ok = ioctl(out, FICLONE, in)==0;
+    if (!ok){
+        // sem reflink: copy_file_range no kernel, read/write como último recurso
+        off_t left = st.st_size; ok = true;
+        while (left>0){
+            ssize_t n = copy_file_range(in, nullptr, out, nullptr, left, 0);
+            if (n<=0) break;
+            left -= n;
+        }
+        if (left>0){
+            lseek(in, 0, SEEK_SET); ftruncate(out, 0); lseek(out, 0, SEEK_SET);
+            char buf[1<<16]; ssize_t n;
+            while ((n=read(in, buf, sizeof buf))>0) if (write(out, buf, n)!=n) { ok=false; break; }
+            if (n<0) ok=false;
+        }
+    }
+    struct timespec ts[2] = {st.st_atim, st.st_mtim};
+    futimens(out, ts);
+    fchmod(out, st.st_mode & 07777);
+    close(in); close(out);
+    std::error_code ec;
+    if (ok) fs::rename(tmp, dst, ec); else fs::remove(tmp, ec);
+    return ok && !ec;
+}
+
+static SyncStats sync_tree(const fs::path &src, const fs::path &dst, Logger &log){
+    SyncStats st;
+    fs::path listf = dst/".cbuild-srcsync";
+    std::set<std::string> previous;
+    { std::ifstream in(listf); std::string l; while (std::getline(in,l)) previous.insert(l); }
+    std::vector<std::string> current;
+    std::vector<std::pair<fs::path, struct stat>> todo;
+    std::error_code ec;
+    for (auto it = fs::recursive_directory_iterator(src, ec); it!=fs::recursive_directory_iterator(); it.increment(ec)){
+        if (it->path().filename()==".git") { it.disable_recursion_pending(); continue; }
+        fs::path rel = it->path().lexically_relative(src);   // relative() seguiria symlinks
+        fs::path out = dst/rel;
+        struct stat s{}, d{};
+        if (lstat(it->path().c_str(), &s)!=0) continue;
+        current.push_back(rel.string());
+        if (S_ISDIR(s.st_mode)) { fs::create_directories(out, ec); continue; }
+        bool have = lstat(out.c_str(), &d)==0;
+        if (S_ISLNK(s.st_mode)){
+            auto target = fs::read_symlink(it->path(), ec);
+            if (have && S_ISLNK(d.st_mode) && fs::read_symlink(out, ec)==target) { st.same++; continue; }
+            fs::remove(out, ec); fs::create_symlink(target, out, ec); st.copied++;
+            continue;
+        }
+        if (!S_ISREG(s.st_mode)) continue;
+        if (have && S_ISREG(d.st_mode) && d.st_size==s.st_size &&
+            d.st_mtim.tv_sec==s.st_mtim.tv_sec && d.st_mtim.tv_nsec==s.st_mtim.tv_nsec) { st.same++; continue; }
+        todo.push_back({rel, s});
+    }
+    // cópias em paralelo: muitos arquivos pequenos dominam o tempo
+    std::atomic<size_t> next{0}, copied{0}; std::atomic<uintmax_t> bytes{0};
+    std::vector<std::thread> pool;
+    unsigned nth = std::max(1u, std::min<unsigned>(std::thread::hardware_concurrency(), 8));
+    for (unsigned j=0; j<std::min<size_t>(nth, todo.size()); ++j)
+        pool.emplace_back([&]{
+            for (size_t i; (i=next++)<todo.size(); ){
+                if (clone_or_copy(src/todo[i].first, dst/todo[i].first, todo[i].second)) { copied++; bytes += todo[i].second.st_size; }
+                else log.warn("Falha ao copiar "+todo[i].first.string());
+            }
+        });
+    for (auto &t: pool) t.join();
+    st.copied += copied; st.bytes = bytes;
+    // removidos na fonte desde a última sincronização (do mais fundo para o mais raso)
+    std::set<std::string> now(current.begin(), current.end());
+    for (auto it=previous.rbegin(); it!=previous.rend(); ++it)
+        if (!now.count(*it)) { fs::path p = dst/(*it); if (!fs::is_directory(p) || fs::is_empty(p)) { fs::remove(p, ec); st.removed++; } }
+    std::ofstream out(listf, std::ios::trunc);
+    for (auto &r: current) out << r << "\n";
+    return st;
+}
+
 static int cmd_extract(const Config&c, const Recipe&r, Logger &log){
     fs::create_directories(c.work);
     fs::path dst = work_dir(c,r);
-    if (fs::exists(dst)) { log.warn("Removendo work antigo: "+dst.string()); fs::remove_all(dst); }
+    fs::path local = local_source_dir(c, r);
+    if (!local.empty()){
+        // fonte local: work/ é mantido entre execuções para que o build seja incremental
+        if (!fs::is_directory(local)) { log.err("srcdir inexistente: "+local.string()); return 4; }
+        fs::create_directories(dst);
+        auto t0 = std::chrono::steady_clock::now();
+        auto st = sync_tree(local, dst, log);
+        long ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now()-t0).count();
+        log.ok("sync "+local.string()+": "+std::to_string(st.copied)+" copiados ("+std::to_string(st.bytes/1024)+" KiB), "
+               +std::to_string(st.same)+" iguais, "+std::to_string(st.removed)+" removidos em "+std::to_string(ms)+" ms");
+        return 0;
+    }
+    if (fs::exists(dst)) { log.warn("Removendo work antigo: "+dst.string()); discard_tree(c, dst); }
     fs::create_directories(dst);
 
     int rc=0; Spinner sp; sp.start("extrai ");
@@ -320,7 +1693,8 @@ static int cmd_extract(const Config&c, const Recipe&r, Logger &log){
         fs::path gitd = c.sources/(r.name+"-git");
         rc = exec_cmd("cp -a '"+gitd.string()+"'/. '"+dst.string()+"/'", log);
         if (rc) return rc;
-        if (r.submodules) exec_cmd("git -C '"+dst.string()+"' submodule update --init --recursive", log);
+        // submódulos já vieram no cp -a; --no-fetch garante que nada vai à rede aqui
+        if (r.submodules) exec_cmd("git -C '"+dst.string()+"' -c protocol.file.allow=always submodule update --init --recursive --no-fetch", log);
     } else {
         log.err("Nada para extrair (sem arquivo fonte nem VCS)");
         return 4;
@@ -375,6 +1749,11 @@ static int cherry_pick_ref(const std::string &repo_url, const std::string &refsp
     return rc;
 }
 
+// patch remoto (http/https) baixado para sources/; o nome depende só da receita e da URL
+static fs::path remote_patch_path(const Config&c, const Recipe&r, const std::string &url){
+    return c.sources/(r.name+"-"+std::to_string(std::hash<std::string>{}(url))+".patch");
+}
+
 static int cmd_patch(const Config&c, const Recipe&r, Logger &log){
     if (r.patches.empty()) { log.info("Sem patches"); return 0; }
     fs::path wd = work_dir(c,r);
@@ -401,7 +1780,7 @@ static int cmd_patch(const Config&c, const Recipe&r, Logger &log){
             if (rc) return rc;
         } else if (is_url(t)){
             // baixa e aplica (git am -> fallback patch)
-            fs::path pf = c.sources/(r.name+"-"+std::to_string(std::hash<std::string>{}(t))+".patch");
+            fs::path pf = remote_patch_path(c, r, t);
             rc = exec_cmd("curl -L --fail -o '"+pf.string()+"' '"+t+"'", log); if(rc) return rc;
             rc = apply_patch_file(pf, wd, log); if(rc) return rc;
         } else {
@@ -419,22 +1798,358 @@ static int cmd_patch(const Config&c, const Recipe&r, Logger &log){
     return 0;
 }
 
-static int run_step(const std::string &label, const fs::path &wd, const std::string &cmd, Logger &log){
-    if (cmd.empty()) { log.info(label+": (vazio)"); return 0; }
-    return exec_cmd("bash -lc 'cd " + wd.string() + " && set -e; " + cmd + "'", log);
-}
-static std::string fakeroot_if_available(){
-    int rc = system("command -v fakeroot >/dev/null 2>&1");
-    return (rc==0) ? "fakeroot " : "";
+// === Verificação de patches ===
+// Aplica a série numa árvore descartável (nunca no work/ do pacote): cada patch é testado com
+// --dry-run e, se passar, aplicado para que os seguintes vejam o resultado dos anteriores.
+// Entradas git: (cherry-pick) não são verificadas dessa forma.
+struct PatchCheck { std::string patch; int status; std::string detail; };   // status: 0 ok, 1 falha, 2 não verificado
+
+// expande patches= em arquivos locais (http(s) baixados para sources/, diretórios ordenados)
+static std::vector<std::pair<std::string,fs::path>> patch_files(const Config&c, const Recipe&r, std::vector<PatchCheck> &skipped){
+    std::vector<std::pair<std::string,fs::path>> out;
+    for (auto &t: Recipe::split_list(r.patches)){
+        if (is_git(t)) { skipped.push_back({t, 2, "git"}); continue; }
+        if (is_url(t)){
+            fs::path pf = remote_patch_path(c, r, t);
+            std::string o;
+            if (!fs::exists(pf) && read_cmd("curl -sS -L --fail -o '"+pf.string()+"' '"+t+"' 2>&1", o)){
+                skipped.push_back({t, 1, "download"}); continue;
+            }
+            out.push_back({t, pf});
+            continue;
+        }
+        fs::path p = t;
+        if (p.is_relative()) p = recipe_dir(c,r.name)/p;
+        if (!fs::exists(p)) { skipped.push_back({t, 1, "não encontrado"}); continue; }
+        if (fs::is_directory(p)){
+            std::vector<fs::path> files;
+            for (auto &e: fs::directory_iterator(p)){
+                auto ext = e.path().extension().string();
+                if (fs::is_regular_file(e) && (ext==".patch" || ext==".diff" || ext==".mbox")) files.push_back(e.path());
+            }
+            std::sort(files.begin(), files.end());
+            for (auto &f: files) out.push_back({(fs::path(t)/f.filename()).string(), f});
+        } else out.push_back({t, p});
+    }
+    return out;
 }
 
-static int collect_manifest(const fs::path &dest, const fs::path &manifest){
-    std::ofstream out(manifest);
-    if (!out) return 1;
-    for (auto &p: fs::recursive_directory_iterator(dest)){
-        if (fs::is_regular_file(p.path())) out << fs::relative(p.path(), dest).string() << "\n";
+static std::vector<PatchCheck> check_patches_in(const Config&c, const Recipe&r, const fs::path &tree){
+    std::vector<PatchCheck> res;
+    auto files = patch_files(c, r, res);
+    for (auto &f: files){
+        std::string first; int ok = -1;
+        for (const char *lvl: {"-p1", "-p0"}){
+            std::string base = "patch -d '"+tree.string()+"' "+lvl+" --batch --forward -s ", o;
+            if (read_cmd(base+"--dry-run < '"+f.second.string()+"' 2>&1", o)==0){
+                read_cmd(base+"< '"+f.second.string()+"' 2>&1", o);
+                ok = 0; break;
+            }
+            if (first.empty()) first = o;   // mensagem do -p1, o caso comum
+        }
+        res.push_back({f.first, ok==0 ? 0 : 1, ok==0 ? "" : first});
     }
-    return 0;
+    return res;
+}
+
+// arquivos que um patch lê: caminhos de ---/+++ nas duas leituras (-p0 e -p1)
+static std::set<std::string> patch_touched(const fs::path &pf){
+    std::set<std::string> out;
+    std::ifstream in(pf); std::string line;
+    while (std::getline(in,line)){
+        if (line.rfind("--- ",0)!=0 && line.rfind("+++ ",0)!=0) continue;
+        std::string p = line.substr(4, line.find('\t')==std::string::npos ? std::string::npos : line.find('\t')-4);
+        p.erase(p.find_last_not_of(" \r")+1);
+        if (p.empty() || p=="/dev/null") continue;
+        out.insert(p);
+        auto sl = p.find('/');
+        if (sl!=std::string::npos && sl+1<p.size()) out.insert(p.substr(sl+1));
+    }
+    return out;
+}
+
+// só os membros tocados pelos patches saem do arquivo (o resto é apenas lido do stream)
+static void extract_members(const fs::path &src, const std::set<std::string> &paths, const fs::path &dst){
+    if (paths.empty()) return;
+    std::string s = src.string(), list, o;
+    for (auto &p: paths) list += " '*/"+p+"'";
+    if (s.size()>=4 && s.substr(s.size()-4)==".zip"){
+        std::string l2; for (auto &p: paths) l2 += " '"+p+"' '*/"+p+"'";
+        read_cmd("unzip -qq -o '"+s+"'"+l2+" -d '"+dst.string()+"' 2>&1", o);
+        return;
+    }
+    read_cmd("tar -xf '"+s+"' -C '"+dst.string()+"' --strip-components=1 --wildcards --no-wildcards-match-slash"+list+" 2>&1", o);
+}
+
+// monta a árvore mínima para os patches da receita e testa a série nela; srcs substitui os
+// arquivos de source_paths (bump testa o que acabou de baixar antes de dar o nome final)
+static std::vector<PatchCheck> check_patches_fresh(const Config&c, const Recipe&r,
+                                                   const std::vector<fs::path> *staged=nullptr){
+    fs::path tmp = c.work/(".check-"+r.name+"-"+r.version);
+    std::error_code ec;
+    fs::remove_all(tmp, ec);
+    fs::create_directories(tmp);
+    std::vector<PatchCheck> skipped;
+    std::set<std::string> need;
+    for (auto &f: patch_files(c, r, skipped)){ auto t = patch_touched(f.second); need.insert(t.begin(), t.end()); }
+    auto srcs = staged ? *staged : source_paths(c,r);
+    for (auto &src: srcs){
+        if (!fs::exists(src)) { fs::remove_all(tmp, ec); return {{src.filename().string(), 1, "fonte ausente"}}; }
+        extract_members(src, need, tmp);
+    }
+    if (srcs.empty() && r.vcs.rfind("git:",0)==0){
+        // git archive falha inteiro se um pathspec não existe; need traz as formas com e sem a/ b/
+        // e arquivos que os patches criam, então só vão os caminhos presentes em HEAD
+        fs::path gitd = c.sources/(r.name+"-git");
+        std::string tree, list, o;
+        read_cmd("git -C '"+gitd.string()+"' ls-tree -r --name-only HEAD 2>/dev/null", tree);
+        std::istringstream ts(tree);
+        for (std::string p; std::getline(ts, p); ) if (need.count(p)) list += " '"+p+"'";
+        if (!list.empty()) read_cmd("git -C '"+gitd.string()+"' archive HEAD --"+list+" 2>/dev/null | tar -xf - -C '"+tmp.string()+"' 2>&1", o);
+    }
+    auto res = check_patches_in(c, r, tmp);
+    fs::remove_all(tmp, ec);
+    return res;
+}
+
+// patch --check: várias receitas em paralelo, sem tocar em work/<pkg>
+static int cmd_patch_check(const Config&c, std::vector<std::string> names, int jobs, Logger &log){
+    if (names.empty()) names = list_recipes(c);
+    struct Row { std::string name; std::vector<PatchCheck> res; bool err{false}; };
+    std::vector<Row> rows(names.size());
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> pool;
+    for (int j=0; j<std::min<int>(jobs, (int)names.size()); ++j)
+        pool.emplace_back([&]{
+            for (size_t i; (i=next++)<names.size(); ){
+                rows[i].name = names[i];
+                Recipe r;
+                try { r = Recipe::load_cached(recipe_ini(c, names[i]), recipe_cache_dir(c)); } catch (...) { rows[i].err = true; continue; }
+                if (Recipe::split_list(r.patches).empty()) continue;
+                rows[i].res = check_patches_fresh(c, r);
+            }
+        });
+    for (auto &t: pool) t.join();
+    int bad = 0;
+    for (auto &row: rows){
+        if (row.err) { ++bad; std::cout << ansi::red << "ERRO " << ansi::reset << row.name << ": receita inválida\n"; continue; }
+        for (auto &pc: row.res){
+            const std::string tag = pc.status==0 ? ansi::green+"ok   " : pc.status==1 ? ansi::red+"FALHA" : ansi::yellow+"--   ";
+            std::cout << tag << ansi::reset << " " << row.name << ": " << pc.patch;
+            if (pc.status==2) std::cout << " (não verificado: " << pc.detail << ")";
+            else if (pc.status==1 && !pc.detail.empty()){
+                std::string d = pc.detail; d.erase(d.find_last_not_of("\n")+1);
+                std::cout << "\n      " << replace_all(d, "\n", "\n      ");
+            }
+            std::cout << "\n";
+            if (pc.status==1) ++bad;
+        }
+    }
+    log.info(std::to_string(bad)+" patch(es) com problema em "+std::to_string(rows.size())+" receita(s)");
+    return bad ? 1 : 0;
+}
+
+// === preflight: espaço em disco e memória antes de começar ===
+// Estima o que o pacote vai ocupar em work/ e destdir/ (tamanho descompactado lido do cabeçalho
+// dos arquivos e histórico de execuções anteriores em logs/usage.tsv) e a memória pelo pico de
+// RSS já observado; se não couber, recusa (ou espera, com --wait) antes de gastar tempo.
+static uintmax_t tree_bytes(const fs::path &p){
+    uintmax_t n = 0; std::error_code ec;
+    for (auto it = fs::recursive_directory_iterator(p, fs::directory_options::skip_permission_denied, ec);
+         !ec && it!=fs::recursive_directory_iterator(); it.increment(ec)){
+        struct stat st{};
+        if (lstat(it->path().c_str(), &st)==0) n += (uintmax_t)st.st_blocks*512;
+    }
+    return n;
+}
+
+// tamanho descompactado pelo cabeçalho; formatos sem essa informação contam 5x o compactado
+static uintmax_t archive_unpacked_bytes(const fs::path &f){
+    std::error_code ec;
+    uintmax_t packed = fs::file_size(f, ec);
+    if (ec) return 0;
+    std::string n = f.filename().string(), out, q = "'"+f.string()+"'";
+    auto ends=[&](const std::string &s){ return n.size()>=s.size() && n.compare(n.size()-s.size(), s.size(), s)==0; };
+    uintmax_t v = 0;
+    if ((ends(".gz") || ends(".tgz")) && read_cmd("gzip -l "+q+" 2>/dev/null", out)==0){
+        std::istringstream ss(out); std::string hdr; std::getline(ss, hdr);
+        uintmax_t comp=0; ss >> comp >> v;
+        if (v<comp && comp>(1u<<20)) v = 0;   // gzip -l guarda o tamanho módulo 4 GiB
+    } else if ((ends(".xz") || ends(".txz")) && read_cmd("xz --robot -l "+q+" 2>/dev/null", out)==0){
+        std::smatch m;
+        if (std::regex_search(out, m, std::regex("\ntotals\t[^\t]*\t[^\t]*\t[^\t]*\t(\\d+)"))) v = std::stoull(m[1]);
+    } else if ((ends(".zst") || ends(".tzst")) && read_cmd("zstd -lv "+q+" 2>&1", out)==0){
+        std::smatch m;
+        if (std::regex_search(out, m, std::regex("Decompressed Size:.*\\((\\d+) B\\)"))) v = std::stoull(m[1]);
+    } else if (ends(".zip") && read_cmd("unzip -Zt "+q+" 2>/dev/null", out)==0){
+        std::smatch m;
+        if (std::regex_search(out, m, std::regex("(\\d+) bytes uncompressed"))) v = std::stoull(m[1]);
+    } else if (ends(".tar")) v = packed;
+    return v ? v : packed*5;
+}
+
+static void record_usage(const Config&c, const Recipe&r, const std::string &kind, uintmax_t bytes){
+    std::ofstream(c.logs/"usage.tsv", std::ios::app) << r.name << '\t' << kind << '\t' << bytes << '\t' << time(nullptr) << "\n";
+}
+
+// maior valor das últimas 3 execuções de cada tipo (work, dest, rss)
+static std::map<std::string,uintmax_t> load_usage(const Config&c, const std::string &pkg){
+    std::map<std::string, std::deque<uintmax_t>> hist;
+    std::ifstream in(c.logs/"usage.tsv");
+    std::string line;
+    while (std::getline(in, line)){
+        std::istringstream ss(line); std::string p, k; uintmax_t b=0;
+        if (!std::getline(ss,p,'\t') || p!=pkg || !std::getline(ss,k,'\t') || !(ss >> b)) continue;
+        auto &d = hist[k]; d.push_back(b);
+        if (d.size()>3) d.pop_front();
+    }
+    std::map<std::string,uintmax_t> out;
+    for (auto &h: hist) out[h.first] = *std::max_element(h.second.begin(), h.second.end());
+    return out;
+}
+
+static uintmax_t mem_available(){
+    std::ifstream in("/proc/meminfo"); std::string k; uintmax_t kb=0; std::string unit;
+    while (in >> k >> kb >> unit) if (k=="MemAvailable:") return kb*1024;
+    return 0;
+}
+
+// make -jN em paralelo multiplica o pico de um compilador
+static int build_jobs(){
+    if (const char *j = getenv("CBUILD_JOBS")) return std::max(1, std::atoi(j));
+    std::smatch m; std::string mf = getenv("MAKEFLAGS") ? getenv("MAKEFLAGS") : "";
+    if (std::regex_search(mf, m, std::regex("-j\\s*(\\d+)"))) return std::max(1, std::stoi(m[1]));
+    return 1;
+}
+
+static std::string human_bytes(uintmax_t b){
+    const char *u[] = {"B","KiB","MiB","GiB","TiB"};
+    double v = b; int i = 0;
+    while (v>=1024 && i<4) { v/=1024; ++i; }
+    char buf[32]; snprintf(buf, sizeof buf, i ? "%.1f %s" : "%.0f %s", v, u[i]);
+    return buf;
+}
+
+// stage: extract, build, install ou all (pipeline inteiro); devolve "" se cabe, senão o motivo
+static std::string preflight_check(const Config&c, const Recipe&r, const std::string &stage, Logger &log){
+    auto hist = load_usage(c, r.name);
+    fs::path wd = work_dir(c,r), dest = destdir_pkg(c,r);
+    uintmax_t unpacked = 0;
+    for (auto &p: source_paths(c,r)) if (fs::exists(p)) unpacked += archive_unpacked_bytes(p);
+    fs::path local = local_source_dir(c, r);
+    if (!local.empty()) unpacked += tree_bytes(local);
+    uintmax_t curWork = fs::exists(wd) ? tree_bytes(wd) : 0, curDest = fs::exists(dest) ? tree_bytes(dest) : 0;
+
+    // necessidade líquida: o que já está em work/destdir do pacote é substituído
+    uintmax_t needWork = 0, needDest = 0, needMem = 0;
+    bool all = stage=="all";
+    if (stage=="extract") needWork = unpacked;
+    if (stage=="build" || all){
+        uintmax_t total = std::max(hist.count("work") ? hist["work"] : unpacked*2, unpacked);
+        needWork = all ? total : (total>curWork ? total-curWork : 0);
+        needMem = hist.count("rss") ? hist["rss"]*build_jobs() : 0;
+    }
+    if (stage=="install" || all){
+        uintmax_t total = hist.count("dest") ? hist["dest"] : (all ? unpacked : curWork/2);
+        needDest = total>curDest ? total-curDest : 0;
+    }
+    if (all && !local.empty()) needWork = needWork>curWork ? needWork-curWork : 0;   // sync incremental
+    auto margin=[&](uintmax_t v){ return v + v*c.preflight_margin_pct/100; };
+
+    struct Need { uintmax_t bytes{0}; fs::path dir; std::string label; };
+    std::map<dev_t, Need> need;   // por sistema de arquivos
+    auto add=[&](const fs::path &dir, uintmax_t n){
+        std::error_code ec; fs::create_directories(dir, ec);
+        struct stat st{};
+        if (n==0 || stat(dir.c_str(), &st)!=0) return;
+        auto &nd = need[st.st_dev];
+        nd.bytes += margin(n); nd.dir = dir;
+        nd.label += (nd.label.empty()?"":"+") + dir.filename().string();
+    };
+    add(c.work, needWork);
+    add(c.destroot, needDest);
+    std::string why;
+    for (auto &kv: need){
+        struct statvfs vf{};
+        if (statvfs(kv.second.dir.c_str(), &vf)!=0) continue;
+        uintmax_t avail = (uintmax_t)vf.f_bavail*vf.f_frsize;
+        log.info("preflight: "+kv.second.label+" precisa ~"+human_bytes(kv.second.bytes)+", livre "+human_bytes(avail));
+        if (kv.second.bytes>avail) why += (why.empty()?"":"; ")+std::string("disco insuficiente para ")+kv.second.label;
+    }
+    if (c.preflight_mem && needMem){
+        uintmax_t avail = mem_available();
+        log.info("preflight: memória ~"+human_bytes(margin(needMem))+" (pico "+human_bytes(hist["rss"])+" x "+
+                 std::to_string(build_jobs())+" jobs), disponível "+human_bytes(avail));
+        if (avail && margin(needMem)>avail) why += (why.empty()?"":"; ")+std::string("memória insuficiente");
+    }
+    return why;
+}
+
+// 0 = pode seguir; com wait tenta de novo a cada 10 s até preflight_wait segundos
+static int preflight(const Config&c, const Recipe&r, const std::string &stage, bool wait, Logger &log){
+    if (!c.preflight) return 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (;;){
+        std::string why = preflight_check(c, r, stage, log);
+        if (why.empty()) return 0;
+        long waited = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now()-t0).count();
+        if (!wait || waited>=c.preflight_wait){
+            log.err(r.name+": "+why+" — não iniciado");
+            return 75;
+        }
+        log.warn(r.name+": "+why+" — aguardando");
+        std::this_thread::sleep_for(std::chrono::seconds(10));
+    }
+}
+
+static int run_step(const std::string &label, const fs::path &wd, const std::string &cmd, Logger &log, uintmax_t *peak=nullptr){
+    if (cmd.empty()) { log.info(label+": (vazio)"); return 0; }
+    log.phase(label);
+    return exec_cmd("bash -lc 'cd " + wd.string() + " && set -e; " + cmd + "'", log, true, nullptr, peak);
+}
+static std::string fakeroot_if_available(){
+    int rc = system("command -v fakeroot >/dev/null 2>&1");
+    return (rc==0) ? "fakeroot " : "";
+}
+
+static int collect_manifest(const fs::path &dest, const fs::path &manifest){
+    std::ofstream out(manifest);
+    if (!out) return 1;
+    for (auto &p: fs::recursive_directory_iterator(dest)){
+        // links simbólicos entram com o próprio caminho (fs::relative resolveria o destino)
+        if (p.is_symlink() || p.is_regular_file()) out << p.path().lexically_relative(dest).string() << "\n";
+    }
+    return 0;
+}
+
+// hash de cada arquivo instalado, ordenado por caminho: caminho, modo (octal), tamanho, sha256.
+// Links simbólicos entram com o hash do texto do destino.
+static int write_sums(const fs::path &dest, const fs::path &out, Logger &log){
+    struct Ent { std::string rel; mode_t mode; uintmax_t size; std::string sum; };
+    std::vector<Ent> ents;
+    std::vector<fs::path> files;
+    std::vector<size_t> fileIdx;
+    std::error_code ec;
+    for (auto it = fs::recursive_directory_iterator(dest, ec); !ec && it!=fs::recursive_directory_iterator(); it.increment(ec)){
+        struct stat st{};
+        if (lstat(it->path().c_str(), &st)!=0 || S_ISDIR(st.st_mode)) continue;
+        Ent e{it->path().lexically_relative(dest).string(), st.st_mode, (uintmax_t)st.st_size, ""};
+        if (S_ISLNK(st.st_mode)){
+            sha256::Ctx ctx; std::string t = fs::read_symlink(it->path(), ec).string();
+            ctx.update((const uint8_t*)t.data(), t.size());
+            e.sum = ctx.final();
+        } else if (S_ISREG(st.st_mode)) { fileIdx.push_back(ents.size()); files.push_back(it->path()); }
+        ents.push_back(e);
+    }
+    auto t0 = std::chrono::steady_clock::now();
+    auto sums = sha256::files(files);
+    for (size_t i=0;i<files.size();++i) ents[fileIdx[i]].sum = sums[i];
+    std::sort(ents.begin(), ents.end(), [](const Ent &a, const Ent &b){ return a.rel < b.rel; });
+    std::ofstream o(out, std::ios::trunc);
+    for (auto &e: ents) o << e.rel << '\t' << std::oct << e.mode << std::dec << '\t' << e.size << '\t' << e.sum << "\n";
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now()-t0).count();
+    log.info("sha256 ("+std::string(sha256::engine())+"): "+std::to_string(files.size())+" arquivos em "+std::to_string(ms)+" ms");
+    return o ? 0 : 1;
 }
 
 static int strip_binaries(const fs::path &dest, Logger &log){
@@ -450,10 +2165,277 @@ static int strip_binaries(const fs::path &dest, Logger &log){
 static int cmd_build_all(const Config&c, const Recipe&r, Logger &log){
     fs::path wd = work_dir(c,r);
     if (!fs::exists(wd)) { log.err("work inexistente, rode extract/patch"); return 7; }
-    int rc=0; rc = run_step("prebuild", wd, r.prebuild, log); if(rc) return rc;
-    rc = run_step("prepare",  wd, r.prepare, log);  if(rc) return rc;
-    rc = run_step("configure",wd, r.configure, log);if(rc) return rc;
-    rc = run_step("build",    wd, r.build, log);    if(rc) return rc;
+    // pico de memória só dos passos deste pacote (não de builds anteriores do queue, nem fetch/extract)
+    uintmax_t peak = 0;
+    int rc=0; rc = run_step("prebuild", wd, r.prebuild, log, &peak); if(rc) return rc;
+    rc = run_step("prepare",  wd, r.prepare, log, &peak);  if(rc) return rc;
+    rc = run_step("configure",wd, r.configure, log, &peak);if(rc) return rc;
+    rc = run_step("build",    wd, r.build, log, &peak);    if(rc) return rc;
+    record_usage(c, r, "work", tree_bytes(wd));
+    if (peak) record_usage(c, r, "rss", peak);
+    return 0;
+}
+
+// === extração de tar em paralelo (pacotes binários, snapshots) ===
+// O tar chega descompactado por um pipe e é lido aqui (ustar, nomes longos GNU e pax). A thread
+// leitora cria os diretórios na hora (o esqueleto fica pronto antes dos arquivos, já que o tar
+// lista os pais primeiro) e entrega cada arquivo pequeno a um pool que abre com openat relativo ao
+// diretório pai, reserva o tamanho com fallocate e grava; arquivos grandes são gravados pela própria
+// leitora em blocos. Nenhum componente do caminho é seguido se for symlink (cada pai é aberto com
+// O_NOFOLLOW), e os symlinks do arquivo só são criados na passada final, então "a -> /etc" seguido
+// de "a/passwd" não escreve fora do destino. Links, donos, datas e modos vão nessa passada e o
+// fsync vira um syncfs só.
+struct UntarStats { size_t files{0}, dirs{0}, links{0}; uintmax_t bytes{0}; };
+
+static bool untar_safe(const std::string &rel){
+    if (rel.empty() || rel[0]=='/') return false;
+    for (auto &comp: fs::path(rel)) if (comp=="..") return false;
+    return true;
+}
+
+// fd do diretório pai de rel sob root, aberto componente a componente sem seguir symlinks;
+// guarda o último pai aberto (o tar agrupa arquivos por diretório). Com mk cria os que faltam.
+struct UntarDir {
+    int root, fd{-1};
+    std::string dir;
+    explicit UntarDir(int r): root(r) {}
+    UntarDir(const UntarDir&) = delete;
+    ~UntarDir(){ if (fd>=0) close(fd); }
+    int parent(const std::string &rel, bool mk, std::string &leaf){
+        size_t cut = rel.rfind('/');
+        leaf = cut==std::string::npos ? rel : rel.substr(cut+1);
+        std::string d = cut==std::string::npos ? "" : rel.substr(0, cut);
+        if (fd>=0 && d==dir) return fd;
+        if (fd>=0) { close(fd); fd = -1; }
+        int cur = dup(root);
+        for (size_t start = 0; cur>=0 && start<d.size(); ){
+            size_t slash = d.find('/', start);
+            if (slash==std::string::npos) slash = d.size();
+            std::string comp = d.substr(start, slash-start);
+            start = slash+1;
+            if (comp.empty() || comp==".") continue;
+            int next = openat(cur, comp.c_str(), O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+            if (next<0 && errno==ENOENT && mk && (mkdirat(cur, comp.c_str(), 0755)==0 || errno==EEXIST))
+                next = openat(cur, comp.c_str(), O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+            int e = errno;
+            close(cur);
+            errno = e;
+            cur = next;
+        }
+        if (cur>=0) { fd = cur; dir = d; }
+        return cur;
+    }
+};
+
+// grava conteúdo inteiro; substitui o que houver no caminho
+static bool untar_write(int dir, const std::string &leaf, const char *p, size_t n, mode_t mode){
+    int fd = openat(dir, leaf.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC|O_NOFOLLOW, 0600);
+    if (fd<0 && (errno==ELOOP || errno==EISDIR || errno==ETXTBSY)){
+        unlinkat(dir, leaf.c_str(), 0);
+        fd = openat(dir, leaf.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC|O_NOFOLLOW, 0600);
+    }
+    if (fd<0) return false;
+    if (n) fallocate(fd, 0, 0, n);   // sem suporte (tmpfs antigo, NFS) só perde a reserva
+    bool ok = true;
+    while (n>0){
+        ssize_t w = write(fd, p, n);
+        if (w<0) { if (errno==EINTR) continue; ok = false; break; }
+        p += w; n -= w;
+    }
+    fchmod(fd, mode & 07777);
+    return close(fd)==0 && ok;
+}
+
+static int extract_tar(const std::string &decomp, const fs::path &dest, int jobs, bool sync,
+                       std::map<std::string,std::string> *meta, UntarStats &st, Logger &log){
+    const size_t BIG = 16<<20, BUDGET = 256<<20;   // limite para ir ao pool / bytes em espera
+    fs::create_directories(dest);
+    int root = open(dest.c_str(), O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if (root<0) { log.err("não foi possível abrir "+dest.string()); return 1; }
+    FILE *in = popen((decomp+" 2>/dev/null").c_str(), "r");
+    if (!in) { close(root); log.err("falha ao executar: "+decomp); return 1; }
+
+    struct Job { std::string rel, data; mode_t mode; };
+    std::deque<Job> queue;
+    std::mutex mu;
+    std::condition_variable cv, room;
+    size_t pending = 0;
+    bool done = false;
+    std::atomic<bool> failed{false};
+    auto worker = [&]{
+        UntarDir dirs(root);
+        std::string leaf;
+        for (;;){
+            Job j;
+            {
+                std::unique_lock<std::mutex> lk(mu);
+                cv.wait(lk, [&]{ return done || !queue.empty(); });
+                if (queue.empty()) return;
+                j = std::move(queue.front()); queue.pop_front();
+            }
+            int dir = dirs.parent(j.rel, false, leaf);
+            if (dir<0 || !untar_write(dir, leaf, j.data.data(), j.data.size(), j.mode)) { failed = true; log.err("falha ao gravar "+j.rel+": "+strerror(errno)); }
+            std::lock_guard<std::mutex> lk(mu);
+            pending -= j.data.size();
+            room.notify_one();
+        }
+    };
+    if (jobs<=0) jobs = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> pool;
+    for (int t=0;t<jobs;++t) pool.emplace_back(worker);
+
+    struct Meta { std::string rel; char type; mode_t mode; uid_t uid; gid_t gid; time_t mtime; };
+    std::vector<Meta> metas;
+    std::vector<std::pair<std::string,std::string>> hardlinks, symlinks;
+    UntarDir dirs(root);
+    std::string leaf;
+    auto readn = [&](char *p, size_t n){ return fread(p, 1, n, in)==n; };
+    auto skip = [&](uintmax_t n){ char b[65536]; while (n>0) { size_t k = std::min<uintmax_t>(n, sizeof b); if (!readn(b, k)) return false; n -= k; } return true; };
+    auto num = [](const char *f, size_t len)->uintmax_t{
+        if ((unsigned char)f[0] & 0x80) {   // base-256 do GNU
+            uintmax_t v = (unsigned char)f[0] & 0x7f;
+            for (size_t i=1;i<len;++i) v = (v<<8) | (unsigned char)f[i];
+            return v;
+        }
+        uintmax_t v = 0;
+        for (size_t i=0;i<len && f[i];++i) if (f[i]>='0' && f[i]<='7') v = v*8+(f[i]-'0');
+        return v;
+    };
+    std::string longName, longLink;
+    std::map<std::string,std::string> pax;
+    bool bad = false, eof = false;
+    char h[512];
+    while (!bad && readn(h, 512)){
+        if (std::all_of(h, h+512, [](char ch){ return ch==0; })) { eof = true; break; }
+        char type = h[156];
+        uintmax_t size = num(h+124, 12);
+        std::string name = longName.empty() ? std::string(h, strnlen(h, 100)) : longName;
+        if (longName.empty() && !memcmp(h+257, "ustar", 5) && h[345]) name = std::string(h+345, strnlen(h+345, 155))+"/"+name;
+        std::string link = longLink.empty() ? std::string(h+157, strnlen(h+157, 100)) : longLink;
+        if (type=='L' || type=='K' || type=='x' || type=='g'){
+            std::string data(size, '\0');
+            if (!readn(&data[0], size) || !skip((512-size%512)%512)) { bad = true; break; }
+            if (type=='L') longName = data.c_str();
+            else if (type=='K') longLink = data.c_str();
+            else if (type=='x'){
+                // registros "<tamanho> chave=valor\n"
+                for (size_t pos=0; pos<data.size(); ){
+                    size_t sp = data.find(' ', pos);
+                    if (sp==std::string::npos) break;
+                    size_t len = std::strtoul(data.c_str()+pos, nullptr, 10);
+                    if (len==0 || pos+len>data.size()) break;
+                    std::string rec = data.substr(sp+1, pos+len-sp-2);
+                    auto eq = rec.find('=');
+                    if (eq!=std::string::npos) pax[rec.substr(0, eq)] = rec.substr(eq+1);
+                    pos += len;
+                }
+            }
+            continue;
+        }
+        if (pax.count("path")) name = pax["path"];
+        if (pax.count("linkpath")) link = pax["linkpath"];
+        if (pax.count("size")) size = std::stoull(pax["size"]);
+        Meta m{"", type, (mode_t)num(h+100, 8), (uid_t)num(h+108, 8), (gid_t)num(h+116, 8), (time_t)num(h+136, 12)};
+        if (pax.count("mtime")) m.mtime = std::atoll(pax["mtime"].c_str());
+        if (pax.count("uid")) m.uid = std::stoul(pax["uid"]);
+        if (pax.count("gid")) m.gid = std::stoul(pax["gid"]);
+        longName.clear(); longLink.clear(); pax.clear();
+        while (name.rfind("./",0)==0) name.erase(0, 2);
+        while (!name.empty() && name.back()=='/') name.pop_back();
+        uintmax_t body = (type=='0' || type=='\0' || type=='7') ? size : 0;
+        uintmax_t padded = (body+511)/512*512;
+        if (name.empty() || name==".") { if (!skip(padded)) bad = true; continue; }
+        if (!untar_safe(name)) { log.warn("entrada ignorada (caminho inseguro): "+name); if (!skip(padded)) bad = true; continue; }
+        m.rel = name;
+        if (meta && meta->count(name)){
+            std::string data(body, '\0');
+            if (!readn(&data[0], body) || !skip(padded-body)) { bad = true; break; }
+            (*meta)[name] = data;
+            continue;
+        }
+        int dir = dirs.parent(name, true, leaf);
+        if (dir<0){
+            bad = true; log.err("diretório de "+name+" inacessível (symlink no caminho?): "+strerror(errno));
+            break;
+        }
+        if (type=='5'){
+            if (mkdirat(dir, leaf.c_str(), 0755)!=0 && errno!=EEXIST) { bad = true; log.err("mkdir "+name+": "+strerror(errno)); }
+            ++st.dirs;
+        } else if (type=='2'){
+            symlinks.push_back({link, name});
+            ++st.links;
+        } else if (type=='1'){
+            while (link.rfind("./",0)==0) link.erase(0, 2);
+            if (untar_safe(link)) hardlinks.push_back({link, name});
+            continue;
+        } else if (type=='0' || type=='\0' || type=='7'){
+            ++st.files; st.bytes += body;
+            if (body<BIG){
+                Job j{name, std::string(body, '\0'), m.mode};
+                if (!readn(&j.data[0], body) || !skip(padded-body)) { bad = true; break; }
+                std::unique_lock<std::mutex> lk(mu);
+                room.wait(lk, [&]{ return pending<BUDGET; });
+                pending += body;
+                queue.push_back(std::move(j));
+                cv.notify_one();
+            } else {
+                // grande: reserva tudo e grava em blocos de 4 MiB sem passar pela memória inteira
+                int fd = openat(dir, leaf.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC|O_NOFOLLOW, 0600);
+                if (fd<0) { unlinkat(dir, leaf.c_str(), 0); fd = openat(dir, leaf.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC|O_NOFOLLOW, 0600); }
+                if (fd<0) { bad = true; log.err("open "+name+": "+strerror(errno)); break; }
+                fallocate(fd, 0, 0, body);
+                std::vector<char> buf(4<<20);
+                for (uintmax_t left = body; left>0 && !bad; ){
+                    size_t k = std::min<uintmax_t>(left, buf.size());
+                    if (!readn(buf.data(), k) || write(fd, buf.data(), k)!=(ssize_t)k) bad = true;
+                    left -= k;
+                }
+                fchmod(fd, m.mode & 07777);
+                if (close(fd)!=0 || !skip(padded-body)) bad = true;
+            }
+        } else {
+            if (!skip(padded)) bad = true;   // dispositivos, fifos: fora do escopo de DESTDIR
+            continue;
+        }
+        metas.push_back(m);
+    }
+    {
+        std::lock_guard<std::mutex> lk(mu);
+        done = true;
+        cv.notify_all();
+    }
+    for (auto &t: pool) t.join();
+    int prc = pclose(in);
+    if (!eof && !bad) bad = prc!=0;
+
+    // passada final, sempre por pais abertos sem seguir symlinks: symlinks, hardlinks e metadados
+    // (filhos antes dos pais, para a data do diretório não mudar depois)
+    for (auto &sl: symlinks){
+        int dir = dirs.parent(sl.second, false, leaf);
+        if (dir>=0) unlinkat(dir, leaf.c_str(), 0);
+        if (dir<0 || symlinkat(sl.first.c_str(), dir, leaf.c_str())!=0) { bad = true; log.err("symlink "+sl.second+": "+strerror(errno)); }
+    }
+    for (auto &hl: hardlinks){
+        std::string from;
+        UntarDir src(root);
+        int sdir = src.parent(hl.first, false, from), dir = dirs.parent(hl.second, true, leaf);
+        if (dir>=0) unlinkat(dir, leaf.c_str(), 0);
+        if (sdir<0 || dir<0 || linkat(sdir, from.c_str(), dir, leaf.c_str(), 0)!=0) { bad = true; log.err("link "+hl.second+": "+strerror(errno)); }
+    }
+    bool asRoot = geteuid()==0;
+    for (auto it = metas.rbegin(); it!=metas.rend(); ++it){
+        int dir = dirs.parent(it->rel, false, leaf);
+        if (dir<0) continue;
+        const char *p = leaf.c_str();
+        if (asRoot && fchownat(dir, p, it->uid, it->gid, AT_SYMLINK_NOFOLLOW)!=0) {}
+        if (it->type=='5') fchmodat(dir, p, it->mode & 07777, 0);
+        else if (asRoot && it->type!='2') fchmodat(dir, p, it->mode & 07777, 0);   // chown limpa setuid
+        struct timespec ts[2] = {{it->mtime, 0}, {it->mtime, 0}};
+        utimensat(dir, p, ts, AT_SYMLINK_NOFOLLOW);
+    }
+    if (sync) syncfs(root);
+    close(root);
+    if (bad || failed) { log.err("extração incompleta em "+dest.string()); return 1; }
     return 0;
 }
 
@@ -473,18 +2455,21 @@ static void make_snapshot(const fs::path &dest, const fs::path &snap, Logger &lo
     }
 }
 
-static void restore_snapshot(const fs::path &dest, const fs::path &snap, Logger &log){
+static void restore_snapshot(const Config&c, const fs::path &dest, const fs::path &snap, Logger &log){
     if (!fs::exists(snap) && !(fs::exists(snap.parent_path()/(snap.filename().string().substr(0, snap.filename().string().size()-4)+".tar.gz")))) return;
     fs::remove_all(dest);
     fs::create_directories(dest);
     int has_zstd = system("command -v zstd >/dev/null 2>&1");
+    UntarStats st;
     if (has_zstd==0 && fs::exists(snap)){
-        exec_cmd_strict("bash -lc 'cd "+dest.string()+" && zstd -dc < "+snap.string()+" | tar -xf -'", log, "restore zstd");
+        if (extract_tar("zstd -dcq '"+snap.string()+"'", dest, c.install_jobs, c.install_sync, nullptr, st, log))
+            throw std::runtime_error("Falha em: restore zstd");
     } else {
         fs::path gz = snap; gz.replace_extension(".tar.gz");
-        if (fs::exists(gz))
-            exec_cmd_strict("bash -lc 'cd "+dest.string()+" && tar -xzf "+gz.string()+"'", log, "restore gzip");
+        if (fs::exists(gz) && extract_tar("gzip -dc '"+gz.string()+"'", dest, c.install_jobs, c.install_sync, nullptr, st, log))
+            throw std::runtime_error("Falha em: restore gzip");
     }
+    log.info("snapshot restaurado: "+std::to_string(st.files)+" arquivos, "+human_bytes(st.bytes));
 }
 
 static std::string ensure_destdir_in_install(const std::string &cmd){
@@ -496,23 +2481,26 @@ static std::string ensure_destdir_in_install(const std::string &cmd){
 static int cmd_install(const Config&c, const Recipe&r, Logger &log){
     fs::path wd = work_dir(c,r);
     fs::path dest = destdir_pkg(c,r);
-    fs::remove_all(dest); fs::create_directories(dest);
+    discard_tree(c, dest); fs::create_directories(dest);
 
-    // snapshot antes de instalar (para rollback se falhar)
+    // snapshot antes de instalar (para rollback se falhar); na classe do install, já que ele espera
     fs::path snap = snapshot_tar(c,r);
     make_snapshot(dest, snap, log);
 
     std::string fr = fakeroot_if_available();
     std::string base = r.install.empty() ? "make install" : r.install;
     base = ensure_destdir_in_install(base);
-    int rc = exec_cmd("bash -lc 'cd " + wd.string() + " && " + fr + " DESTDIR="+dest.string()+" " + base + "'", log);
+    int rc = exec_cmd("bash -lc 'cd " + wd.string() + " && export DESTDIR="+dest.string()+" && " + fr + base + "'", log);
     if (rc) {
         log.err("Instalação falhou — restaurando snapshot");
-        restore_snapshot(dest, snap, log);
+        restore_snapshot(c, dest, snap, log);
         return rc;
     }
     if (r.strip) strip_binaries(dest, log);
+    record_usage(c, r, "dest", tree_bytes(dest));
     collect_manifest(dest, install_manifest(c,r));
+    write_sums(dest, sums_file(c,r), log);
+    std::ofstream(recipe_stamp(c,r), std::ios::trunc) << r.fingerprint() << "\n";
     rc = run_step("postinstall", wd, r.postinstall, log); if(rc) return rc;
     log.ok("Instalado em DESTDIR: "+dest.string());
     return 0;
@@ -532,7 +2520,7 @@ static int cmd_remove(const Config&c, const Recipe&r, Logger &log){
             fs::path f = dest/rel;
             std::error_code ec; fs::remove(f, ec);
         }
-        fs::remove_all(dest);
+        discard_tree(c, dest);
         log.ok("Removido DESTDIR: "+dest.string());
         if (!r.postremove.empty()){
             exec_cmd(r.postremove, log);
@@ -540,7 +2528,7 @@ static int cmd_remove(const Config&c, const Recipe&r, Logger &log){
         return 0;
     } else {
         log.warn("Manifesto não encontrado: "+manf.string()+", limpando DESTDIR");
-        fs::remove_all(dest);
+        discard_tree(c, dest);
         if (!r.postremove.empty()){
             exec_cmd(r.postremove, log);
         }
@@ -560,46 +2548,302 @@ static int cmd_info(const Config&c, const Recipe&r, Logger &log){
 
 static int cmd_search(const Config&c, const std::string &pattern, Logger &log){
     std::regex rx(pattern, std::regex::icase);
-    for (auto &d: fs::directory_iterator(c.recipes)){
-        if (!fs::is_directory(d)) continue;
-        fs::path ini = d.path()/"recipe.ini";
-        if (!fs::exists(ini)) continue;
-        std::ifstream in(ini); std::string s((std::istreambuf_iterator<char>(in)),{});
-        if (std::regex_search(s, rx)) std::cout << d.path().filename().string() << "\n";
+    for (auto &name: list_recipes(c)){
+        std::ifstream in(recipe_ini(c,name)); std::string s((std::istreambuf_iterator<char>(in)),{});
+        if (std::regex_search(s, rx)) std::cout << name << "\n";
     }
     return 0;
 }
 
+// atualiza repo/<nome> com fetch + fast-forward e devolve as receitas tocadas pelo diff
+// (nullopt = clone novo ou diff impossível: reindexa o repositório inteiro)
+static int sync_repo(const Config&c, const RecipeRepo &rr, std::optional<std::set<std::string>> &changed, Logger &log){
+    fs::path d = c.repo/rr.name;
+    std::string g = "git -C '"+d.string()+"' ";
+    if (!fs::exists(d/".git")){
+        changed.reset();
+        fs::create_directories(c.repo);
+        return exec_cmd("git clone '"+rr.url+"' '"+d.string()+"'", log);
+    }
+    std::string oldHead, newHead;
+    read_cmd(g+"rev-parse HEAD 2>/dev/null", oldHead);
+    int rc = exec_cmd(g+"fetch origin", log);
+    if (rc) return rc;
+    read_cmd(g+"rev-parse FETCH_HEAD 2>/dev/null", newHead);
+    oldHead.erase(oldHead.find_last_not_of("\n")+1); newHead.erase(newHead.find_last_not_of("\n")+1);
+    changed = std::set<std::string>{};
+    if (oldHead==newHead) return 0;
+    std::string diff;
+    if (read_cmd(g+"diff --name-only "+oldHead+" "+newHead, diff)) changed.reset();
+    else {
+        std::stringstream ss(diff); std::string path;
+        while (std::getline(ss,path)) changed->insert(path.substr(0, path.find('/')));
+    }
+    rc = exec_cmd(g+"merge --ff-only FETCH_HEAD", log);
+    if (rc) log.err("repo "+rr.name+": não é fast-forward (alterações locais?), mantendo a versão atual");
+    return rc;
+}
+
 static int cmd_sync(const Config&c, Logger &log){
-    if (!fs::exists(c.recipes)) { log.err("recipes/ não existe"); return 1; }
-    exec_cmd("git -C '"+c.recipes.string()+"' init", log);
-    exec_cmd("git -C '"+c.recipes.string()+"' add -A", log);
-    exec_cmd("git -C '"+c.recipes.string()+"' -c user.email=cbuild@local -c user.name=cbuild commit -m 'cbuild sync' || true", log);
-    int rc = system(("git -C '"+c.recipes.string()+"' remote get-url origin >/dev/null 2>&1").c_str());
-    if (rc==0) exec_cmd("git -C '"+c.recipes.string()+"' push origin HEAD", log);
-    return 0;
+    if (!fs::exists(c.recipes) && c.repos.empty()) { log.err("recipes/ não existe"); return 1; }
+    if (fs::exists(c.recipes)){
+        exec_cmd("git -C '"+c.recipes.string()+"' init", log);
+        exec_cmd("git -C '"+c.recipes.string()+"' add -A", log);
+        exec_cmd("git -C '"+c.recipes.string()+"' -c user.email=cbuild@local -c user.name=cbuild commit -m 'cbuild sync' || true", log);
+        int rc = system(("git -C '"+c.recipes.string()+"' remote get-url origin >/dev/null 2>&1").c_str());
+        if (rc==0) exec_cmd("git -C '"+c.recipes.string()+"' push origin HEAD", log);
+    }
+    if (c.repos.empty()) return 0;
+
+    // repositórios em paralelo; índice atualizado só nas receitas alteradas
+    std::vector<std::optional<std::set<std::string>>> changed(c.repos.size());
+    std::vector<int> rcs(c.repos.size(), 0);
+    std::vector<std::thread> th;
+    for (size_t i=0;i<c.repos.size();++i) th.emplace_back([&,i]{ rcs[i] = sync_repo(c, c.repos[i], changed[i], log); });
+    for (auto &t: th) t.join();
+
+    auto idx = read_recipe_index(c);
+    std::set<std::string> known;
+    for (auto &r: c.repos) known.insert(r.name);
+    for (auto it=idx.begin(); it!=idx.end(); ) it = known.count(it->first) ? std::next(it) : idx.erase(it);
+    int failed = 0;
+    for (size_t i=0;i<c.repos.size();++i){
+        auto &rr = c.repos[i];
+        fs::path d = c.repo/rr.name;
+        if (rcs[i]) { ++failed; continue; }
+        if (!changed[i] || !idx.count(rr.name)){
+            idx[rr.name] = scan_repo_recipes(d);
+            log.ok("repo "+rr.name+": "+std::to_string(idx[rr.name].size())+" receitas indexadas");
+            continue;
+        }
+        auto &names = idx[rr.name];
+        for (auto &n: *changed[i]){
+            if (fs::exists(d/n/"recipe.ini")) names.insert(n); else names.erase(n);
+        }
+        log.ok("repo "+rr.name+": "+std::to_string(changed[i]->size())+" entrada(s) alterada(s)");
+    }
+    write_recipe_index(c, idx);
+    return failed ? 1 : 0;
+}
+
+// === índice de arquivos do repositório binário (files.cbfi) ===
+// Todos os caminhos de todos os pacotes, ordenados e com codificação front-coded em blocos de 32
+// (prefixo comum com o anterior + sufixo + dono); o primeiro de cada bloco é completo, o que
+// permite busca binária entre blocos direto no mmap. Uma segunda seção igual guarda os basenames
+// apontando para o número do caminho, para "quem fornece libfoo.so.3" sem varrer tudo.
+namespace cbfi {
+struct Sec  { uint64_t count, nblocks, blocks, data; };
+struct Head { char magic[4]; uint32_t version, nowners, pad; uint64_t owners, total; Sec paths, bases; };
+static const uint32_t BLOCK = 32;
+
+static void put_varint(std::string &o, uint64_t v){ while (v>=0x80) { o += (char)(v|0x80); v >>= 7; } o += (char)v; }
+static uint64_t get_varint(const uint8_t *&p, const uint8_t *end){
+    uint64_t v = 0;
+    for (int s=0; p<end && s<64; s+=7) { uint8_t b = *p++; v |= (uint64_t)(b&0x7f) << s; if (!(b&0x80)) break; }
+    return v;
+}
+
+// grava uma seção: chaves já ordenadas, valor numérico por chave
+struct Writer {
+    std::string data, prev;
+    std::vector<uint64_t> blocks;
+    uint64_t count{0};
+    void add(std::string_view k, uint64_t v){
+        size_t common = 0;
+        if (count%BLOCK==0) blocks.push_back(data.size());
+        else while (common<prev.size() && common<k.size() && prev[common]==k[common]) ++common;
+        put_varint(data, common);
+        put_varint(data, k.size()-common);
+        data.append(k.data()+common, k.size()-common);
+        put_varint(data, v);
+        prev.assign(k);
+        ++count;
+    }
+};
+
+static std::string build(const std::vector<std::string> &owners, Writer &paths, Writer &bases){
+    Head h{{'C','B','F','I'}, 1, (uint32_t)owners.size(), 0, sizeof(Head), 0, {}, {}};
+    std::string ow;
+    std::vector<uint32_t> oo;
+    for (auto &o: owners) { oo.push_back(ow.size()); ow += o; }
+    oo.push_back(ow.size());
+    std::string body;
+    body.append((const char*)oo.data(), 4*oo.size());
+    body += ow;
+    auto sec = [&](Writer &w, Sec &s){
+        body.resize((body.size()+7)&~(size_t)7, '\0');
+        s.count = w.count; s.nblocks = w.blocks.size();
+        s.blocks = sizeof(Head)+body.size();
+        body.append((const char*)w.blocks.data(), 8*w.blocks.size());
+        s.data = sizeof(Head)+body.size();
+        body += w.data;
+    };
+    sec(paths, h.paths);
+    sec(bases, h.bases);
+    h.total = sizeof(Head)+body.size();
+    return std::string((const char*)&h, sizeof h)+body;
+}
+
+struct Index {
+    const uint8_t *base{nullptr}; size_t len{0};
+    const Head *h{nullptr};
+    Index() = default;
+    Index(const Index&) = delete;
+    ~Index(){ if (base) munmap((void*)base, len); }
+    bool open(const fs::path &p){
+        int fd = ::open(p.c_str(), O_RDONLY|O_CLOEXEC);
+        if (fd<0) return false;
+        struct stat st{};
+        if (fstat(fd, &st)==0 && st.st_size>=(off_t)sizeof(Head)){
+            void *m = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (m!=MAP_FAILED) { base = (const uint8_t*)m; len = st.st_size; }
+        }
+        close(fd);
+        if (!base) return false;
+        h = (const Head*)base;
+        // cada bloco começa dentro da seção de dados; donos com offsets crescentes dentro do arquivo
+        auto secOk = [&](const Sec &s){
+            if (s.blocks>len || s.nblocks>(len-s.blocks)/8 || s.data>len || s.nblocks!=(s.count+BLOCK-1)/BLOCK) return false;
+            auto *b = (const uint64_t*)(base+s.blocks);
+            for (uint64_t i=0;i<s.nblocks;++i) if (b[i]>=len-s.data) return false;
+            return true;
+        };
+        bool ok = !memcmp(h->magic, "CBFI", 4) && h->version==1 && h->total==len && h->owners<=len &&
+                  h->owners+4ull*(h->nowners+1)<=len && secOk(h->paths) && secOk(h->bases);
+        if (ok){
+            auto *o = (const uint32_t*)(base+h->owners);
+            for (uint32_t i=0; ok && i<h->nowners; ++i) ok = o[i]<=o[i+1];
+            ok = ok && h->owners+4ull*(h->nowners+1)+o[h->nowners]<=len;
+        }
+        if (!ok) { munmap((void*)base, len); base = nullptr; h = nullptr; }
+        return ok;
+    }
+    std::string_view owner(uint64_t i) const {
+        if (i>=h->nowners) return {};
+        auto *o = (const uint32_t*)(base+h->owners);
+        return {(const char*)(base+h->owners+4*(h->nowners+1)+o[i]), o[i+1]-o[i]};
+    }
+    // percorre a seção a partir do bloco b; cb(ordinal, chave, valor) devolve false para parar
+    template<class F> void walk(const Sec &s, uint64_t b, F cb) const {
+        std::string key;
+        auto *blocks = (const uint64_t*)(base+s.blocks);
+        for (; b<s.nblocks; ++b){
+            const uint8_t *p = base+s.data+blocks[b], *end = base+len;
+            for (uint64_t k=b*BLOCK; k<std::min<uint64_t>(s.count, (b+1)*BLOCK); ++k){
+                uint64_t common = get_varint(p, end), n = get_varint(p, end);
+                if (common>key.size() || n>(uint64_t)(end-p)) return;
+                key.resize(common);
+                key.append((const char*)p, n); p += n;
+                if (!cb(k, (std::string_view)key, get_varint(p, end))) return;
+            }
+        }
+    }
+    std::string_view first(const Sec &s, uint64_t b) const {
+        const uint8_t *p = base+s.data+((const uint64_t*)(base+s.blocks))[b], *end = base+len;
+        get_varint(p, end);
+        uint64_t n = get_varint(p, end);
+        return {(const char*)p, (size_t)std::min<uint64_t>(n, end-p)};
+    }
+    // chaves que começam com prefix, em ordem
+    template<class F> void prefix(const Sec &s, std::string_view pre, F cb) const {
+        uint64_t lo = 0, hi = s.nblocks;
+        while (lo<hi) { uint64_t m = (lo+hi)/2; if (first(s, m)<pre) lo = m+1; else hi = m; }
+        walk(s, lo ? lo-1 : 0, [&](uint64_t k, std::string_view key, uint64_t v){
+            if (key.substr(0, pre.size())==pre) return cb(k, key, v);
+            return key<pre;
+        });
+    }
+    // caminho e dono do ordinal i
+    std::pair<std::string, uint64_t> path(uint64_t i) const {
+        std::pair<std::string, uint64_t> r{"", 0};
+        walk(h->paths, i/BLOCK, [&](uint64_t k, std::string_view key, uint64_t v){
+            if (k<i) return true;
+            r = {std::string(key), v}; return false;
+        });
+        return r;
+    }
+    // exato ("usr/bin/xyz"), basename ("libfoo.so.3") ou glob ("usr/lib/*.so.3", "lib*.so.*"; sem
+    // "/" o glob vale para o basename, e "*" atravessa diretórios); cb(caminho, dono)
+    template<class F> void query(std::string q, F cb) const {
+        while (!q.empty() && q[0]=='/') q.erase(0, 1);
+        if (q.rfind("so:",0)==0) q = q.substr(3);
+        size_t wild = q.find_first_of("*?[");
+        bool slash = q.find('/')!=std::string::npos;
+        std::string lit = q.substr(0, wild);
+        if (wild==std::string::npos && slash){
+            prefix(h->paths, q, [&](uint64_t, std::string_view key, uint64_t v){ if (key==q) cb(key, owner(v)); return key==q; });
+        } else if (wild==std::string::npos){
+            std::vector<uint64_t> ords;
+            prefix(h->bases, q, [&](uint64_t, std::string_view key, uint64_t v){ if (key==q) ords.push_back(v); return key==q; });
+            for (auto o: ords) { auto p = path(o); cb(p.first, owner(p.second)); }
+        } else if (slash && q.find_first_of("*?[", q.rfind('/'))==std::string::npos && lit.size()<q.size()-q.rfind('/')-1){
+            // "*/pkg/f.txt": o basename literal é mais seletivo que o prefixo do caminho
+            std::string bname = q.substr(q.rfind('/')+1);
+            std::vector<uint64_t> ords;
+            prefix(h->bases, bname, [&](uint64_t, std::string_view key, uint64_t v){ if (key==bname) ords.push_back(v); return key==bname; });
+            for (auto o: ords) { auto p = path(o); if (fnmatch(q.c_str(), p.first.c_str(), 0)==0) cb(p.first, owner(p.second)); }
+        } else if (slash){
+            prefix(h->paths, lit, [&](uint64_t, std::string_view key, uint64_t v){
+                if (fnmatch(q.c_str(), std::string(key).c_str(), 0)==0) cb(key, owner(v));
+                return true;
+            });
+        } else {
+            std::vector<uint64_t> ords;
+            prefix(h->bases, lit, [&](uint64_t, std::string_view key, uint64_t v){
+                if (fnmatch(q.c_str(), std::string(key).c_str(), 0)==0) ords.push_back(v);
+                return true;
+            });
+            std::sort(ords.begin(), ords.end());
+            for (auto o: ords) { auto p = path(o); cb(p.first, owner(p.second)); }
+        }
+    }
+};
+} // namespace cbfi
+
+// índice de arquivos a consultar: o baixado pelo repo-pull ou o do repositório local
+static fs::path files_index_path(const Config&c){
+    fs::path pulled = c.base/"binrepo"/"files.cbfi";
+    return fs::exists(pulled) ? pulled : c.binrepo/"files.cbfi";
 }
 
 static int cmd_revdep(const Config&c, const Recipe&r, Logger &log){
     fs::path dest = destdir_pkg(c,r);
     if (!fs::exists(dest)) { log.err("DESTDIR inexistente: "+dest.string()); return 1; }
     std::map<std::string, std::set<std::string>> dep2bins;
+    std::set<std::string> missing, own;   // own: nomes dos arquivos do próprio pacote
     for (auto &p: fs::recursive_directory_iterator(dest)){
+        own.insert(p.path().filename().string());
         if (fs::is_regular_file(p.path()) && is_elf(p.path())){
-            std::string cmd = "ldd '" + p.path().string() + "' | awk '{print $1}' | sed -e 's/://g'";
+            std::string cmd = "ldd '" + p.path().string() + "' | awk '{print $1, $3}' | sed -e 's/://g'";
             FILE *f = popen(cmd.c_str(),"r"); char buf[512];
             while (f && fgets(buf,sizeof(buf),f)){
-                std::string lib(buf); lib.erase(std::remove_if(lib.begin(), lib.end(), ::isspace), lib.end());
-                if (!lib.empty()) dep2bins[lib].insert(fs::relative(p.path(), dest).string());
+                std::istringstream ls(buf); std::string lib, where;
+                ls >> lib >> where;
+                if (lib.empty()) continue;
+                dep2bins[lib].insert(fs::relative(p.path(), dest).string());
+                if (where=="not") missing.insert(lib);
             }
             if (f) pclose(f);
         }
     }
+    // libs que o próprio pacote instala não estão no caminho de bibliotecas do host, mas não faltam
+    for (auto it = missing.begin(); it!=missing.end(); ) it = own.count(*it) ? missing.erase(it) : std::next(it);
     for (auto &kv: dep2bins){
-        std::cout << ansi::bold << kv.first << ansi::reset << " <- ";
+        std::cout << ansi::bold << kv.first << ansi::reset << (missing.count(kv.first) ? ansi::red+" (não encontrada)"+ansi::reset : "") << " <- ";
         bool first=true; for (auto &b: kv.second){ if(!first) std::cout << ", "; std::cout << b; first=false; }
         std::cout << "\n";
     }
+    // libs ausentes: quem as fornece no repositório binário
+    cbfi::Index idx;
+    if (!missing.empty() && idx.open(files_index_path(c))){
+        for (auto &lib: missing){
+            std::set<std::string> by;
+            idx.query(lib, [&](std::string_view path, std::string_view owner){ by.insert(std::string(owner)+" (/"+std::string(path)+")"); });
+            std::cout << lib << " -> " << (by.empty() ? "nenhum pacote do repositório" : "");
+            bool first=true; for (auto &b: by){ if(!first) std::cout << ", "; std::cout << b; first=false; }
+            std::cout << "\n";
+        }
+    }
     return 0;
 }
 
@@ -611,78 +2855,2613 @@ static int cmd_mkpkg(const Config&c, const std::string &name, Logger &log){
     return rc;
 }
 
-static const std::map<std::string,std::string> aliases = {
-    {"dl","fetch"},{"x","extract"},{"p","patch"},{"b","build"},{"i","install"},{"rm","remove"},
-    {"srch","search"},{"inf","info"},{"rv","revdep"},{"mk","mkpkg"}
-};
+// === verify-sources: confere sources/ inteiro contra os sha256= das receitas ===
+// Cada arquivo é ligado às entradas de url= que o referenciam; os fixados são lidos em paralelo
+// (no máximo `jobs` leituras simultâneas) e classificados em ok, corrompido, ausente,
+// órfão (nenhuma receita usa) e sem sha256=. Patches remotos baixados para sources/ não têm
+// sha256= e são listados à parte; diretórios (git-cache/, clones <pkg>-git) não entram.
+static int cmd_verify_sources(const Config&c, int jobs, bool deleteCorrupt, Logger &log){
+    struct Ref { std::string recipe, sum; };
+    std::map<std::string, std::vector<Ref>> refs;   // nome do arquivo em sources/ -> receitas
+    std::map<std::string, std::string> patchRefs;   // patch remoto -> receita
+    for (auto &n: list_recipes(c)){
+        Recipe r;
+        try { r = Recipe::load_cached(recipe_ini(c, n), recipe_cache_dir(c)); } catch (...) { log.warn("receita inválida: "+n); continue; }
+        for (auto &t: Recipe::split_list(r.patches))
+            if (!is_git(t) && is_url(t)) patchRefs[remote_patch_path(c, r, t).filename().string()] = r.name+"-"+r.version;
+        auto sums = Recipe::split_list(r.sha256);
+        auto dsts = source_paths(c, r);
+        if (archive_urls(r).empty()) continue;   // só vcs/srcdir: nada em sources/ para conferir
+        for (size_t i=0;i<dsts.size();++i) refs[dsts[i].filename().string()].push_back({r.name+"-"+r.version, i<sums.size() ? sums[i] : ""});
+    }
+    std::vector<std::string> orphans, patches;
+    std::error_code ec;
+    for (auto &e: fs::directory_iterator(c.sources, ec)){
+        std::string f = e.path().filename().string();
+        if (!e.is_regular_file(ec) || refs.count(f)) continue;
+        auto pr = patchRefs.find(f);
+        if (pr!=patchRefs.end()) patches.push_back(f+" ("+pr->second+")");
+        else orphans.push_back(f);
+    }
 
-static std::string resolve_cmd(std::string c){
-    if (aliases.count(c)) return aliases.at(c);
-    std::vector<std::string> cmds = {"help","init","fetch","extract","patch","build","install","remove","info","search","sync","revdep","mkpkg"};
-    std::vector<std::string> m;
-    for (auto &x:cmds) if (x.rfind(c,0)==0) m.push_back(x);
-    if (m.size()==1) return m[0];
-    return c;
+    struct Item { std::string file; std::vector<Ref> refs; std::string got; uintmax_t size{0}; };
+    std::vector<Item> pinned;
+    std::vector<std::pair<std::string,std::string>> missing, unpinned;   // arquivo, receitas
+    auto who=[](const std::vector<Ref> &v){ std::string s; for (auto &r: v) s += (s.empty()?"":", ")+r.recipe; return s; };
+    for (auto &kv: refs){
+        fs::path p = c.sources/kv.first;
+        if (!fs::exists(p, ec)) { missing.push_back({kv.first, who(kv.second)}); continue; }
+        bool any = false;
+        for (auto &r: kv.second) any |= !r.sum.empty();
+        if (!any) { unpinned.push_back({kv.first, who(kv.second)}); continue; }
+        pinned.push_back({kv.first, kv.second, "", fs::file_size(p, ec)});
+    }
+    // maiores primeiro, para as threads terminarem juntas
+    std::sort(pinned.begin(), pinned.end(), [](const Item &a, const Item &b){ return a.size > b.size; });
+    auto t0 = std::chrono::steady_clock::now();
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> pool;
+    for (int j=0; j<std::min<int>(std::max(1, jobs), (int)pinned.size()); ++j)
+        pool.emplace_back([&]{
+            for (size_t i; (i=next++)<pinned.size(); ) pinned[i].got = sha256::file(c.sources/pinned[i].file);
+        });
+    for (auto &t: pool) t.join();
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count();
+
+    int corrupt = 0;
+    uintmax_t bytes = 0;
+    for (auto &it: pinned){
+        bytes += it.size;
+        std::vector<std::string> bad;
+        for (auto &r: it.refs) if (!r.sum.empty() && r.sum!=it.got) bad.push_back(r.recipe+" espera "+r.sum);
+        if (bad.empty()) continue;
+        ++corrupt;
+        std::cout << ansi::red << "CORROMPIDO " << ansi::reset << it.file << " (" << (it.got.empty() ? "ilegível" : it.got) << ")\n";
+        for (auto &b: bad) std::cout << "           " << b << "\n";
+        if (deleteCorrupt && fs::remove(c.sources/it.file, ec)) std::cout << "           removido\n";
+    }
+    for (auto &m: missing) std::cout << ansi::yellow << "AUSENTE    " << ansi::reset << m.first << " (" << m.second << ")\n";
+    for (auto &u: unpinned) std::cout << ansi::yellow << "SEM SHA256 " << ansi::reset << u.first << " (" << u.second << ")\n";
+    for (auto &p: patches) std::cout << ansi::dim << "PATCH      " << ansi::reset << p << "\n";
+    for (auto &o: orphans) std::cout << ansi::dim << "ÓRFÃO      " << ansi::reset << o << "\n";
+    log.info(std::to_string(pinned.size()-corrupt)+" ok, "+std::to_string(corrupt)+" corrompido(s), "+std::to_string(missing.size())+
+             " ausente(s), "+std::to_string(unpinned.size())+" sem sha256, "+std::to_string(patches.size())+" patch(es) remoto(s), "+
+             std::to_string(orphans.size())+" órfão(s); "+
+             human_bytes(bytes)+" em "+std::to_string((int)secs)+" s ("+human_bytes(secs>0 ? (uintmax_t)(bytes/secs) : bytes)+"/s)");
+    return corrupt ? 1 : 0;
 }
 
-static void print_help(){
-    std::cout << ansi::bold << "cbuild — ferramenta de build por receita" << ansi::reset << "\n";
-    std::cout << "Comandos:\n"
-              << "  init <nome>           cria receita\n"
-              << "  fetch <nome>          baixa fonte (curl/git) [suporta múltiplos tarballs]\n"
-              << "  extract <nome>        extrai para work/\n"
-              << "  patch <nome>          aplica patches http(s)/git/dir (git:@REF|A..B)\n"
-              << "  build <nome>          roda prebuild/prepare/configure/build\n"
-              << "  install <nome>        instala em DESTDIR (fakeroot) + postinstall [rollback]\n"
-              << "  remove <nome>         remove DESTDIR + hook pós-remover [snapshot]\n"
-              << "  info <nome>           mostra infos da receita\n"
-              << "  search <regex>        busca em receitas\n"
-              << "  sync                  commit/push recipes/ (se origin configurado)\n"
-              << "  revdep <nome>         verifica libs usadas pelos binários\n"
-              << "  mkpkg <nome>          cria pasta do programa + receita juntos\n"
-              << "\nAliases: dl, x, p, b, i, rm, srch, inf, rv, mk\n";
+// leitura dos logs por execução: usa o .idx para descomprimir só os frames das fases pedidas
+static int cmd_log(const Config&c, const std::string &pkg, int runN, const std::string &phase,
+                   const std::string &grep, bool list, Logger &log){
+    fs::path dir = c.logs/pkg;
+    int last = last_run(dir);
+    if (last==0) { log.err("Sem logs para "+pkg); return 1; }
+    std::unique_ptr<std::regex> rx;
+    if (!grep.empty()) rx = std::make_unique<std::regex>(grep);
+    auto emit=[&](const std::string &ph, const std::string &line){
+        if (rx && !std::regex_search(line, *rx)) return;
+        if (rx) std::cout << ansi::dim << ph << ": " << ansi::reset;
+        std::cout << line << "\n";
+    };
+    if (list){
+        for (int n=1;n<=last;++n){
+            fs::path idx = dir/(std::to_string(n)+".idx"), plain = dir/(std::to_string(n)+".log");
+            if (fs::exists(plain)) { std::cout << n << "  (em andamento/incompleto)\n"; continue; }
+            std::ifstream in(idx); if (!in) continue;
+            std::string line, tool; std::getline(in, tool);
+            std::cout << n << " ";
+            while (std::getline(in,line)) std::cout << " " << line.substr(0, line.find('\t'));
+            std::cout << "\n";
+        }
+        return 0;
+    }
+    if (runN<=0) runN = last;
+    fs::path idx = dir/(std::to_string(runN)+".idx");
+    fs::path plain = dir/(std::to_string(runN)+".log");
+    if (fs::exists(idx)){
+        std::ifstream in(idx); std::string tool, line;
+        std::getline(in, tool);
+        fs::path comp = dir/(std::to_string(runN)+".log"+(tool=="zstd"?".zst":".gz"));
+        while (std::getline(in,line)){
+            std::stringstream ss(line); std::string ph; uintmax_t coff=0, clen=0;
+            std::getline(ss, ph, '\t'); ss >> coff >> clen;
+            if (!phase.empty() && ph!=phase) continue;
+            // tail -c +K faz seek no arquivo; só o frame desta fase é descomprimido
+            std::string cmd = "tail -c +"+std::to_string(coff+1)+" '"+comp.string()+"' | head -c "+std::to_string(clen)
+                            + " | "+(tool=="zstd"?"zstd -dcq":"gzip -dc");
+            FILE *p = popen(cmd.c_str(), "r"); if (!p) return 127;
+            char buf[4096]; std::string cur;
+            while (fgets(buf, sizeof buf, p)){
+                cur += buf;
+                if (cur.back()!='\n') continue;
+                cur.pop_back(); emit(ph, cur); cur.clear();
+            }
+            if (!cur.empty()) emit(ph, cur);
+            pclose(p);
+        }
+        return 0;
+    }
+    if (fs::exists(plain)){
+        std::ifstream in(plain); std::string line, ph="-";
+        while (std::getline(in,line)){
+            if (line.rfind("==> fase: ",0)==0) ph = line.substr(10);
+            if (phase.empty() || ph==phase) emit(ph, line);
+        }
+        return 0;
+    }
+    log.err("Execução "+std::to_string(runN)+" não encontrada para "+pkg);
+    return 1;
 }
 
-int main(int argc, char **argv){
-    std::ios::sync_with_stdio(false);
-    Config cfg = make_default_config();
-    fs::create_directories(cfg.base);
+// === outdated: versões upstream ===
+// Estratégia derivada da receita:
+//   vcs=git:URL  -> git ls-remote --tags URL
+//   url=http...  -> listagem do diretório do arquivo (ou do diretório-pai, se a versão
+//                   aparece no caminho, ex.: .../gcc-13.2.0/gcc-13.2.0.tar.xz)
+// Consultas rodam em paralelo (outdated_jobs), com no máximo fetch_per_host por host,
+// e os resultados ficam em cache/outdated.tsv por outdated_ttl segundos.
+static int version_cmp(const std::string &a, const std::string &b){
+    size_t i=0, j=0;
+    while (i<a.size() || j<b.size()){
+        auto num = [](const std::string &s, size_t &k)->std::string{
+            size_t st=k; while (k<s.size() && isdigit((unsigned char)s[k])) ++k; return s.substr(st, k-st);
+        };
+        auto alp = [](const std::string &s, size_t &k)->std::string{
+            size_t st=k; while (k<s.size() && !isdigit((unsigned char)s[k])) ++k; return s.substr(st, k-st);
+        };
+        std::string na = num(a,i), nb = num(b,j);
+        na.erase(0, std::min(na.find_first_not_of('0'), na.size()));
+        nb.erase(0, std::min(nb.find_first_not_of('0'), nb.size()));
+        if (na.size()!=nb.size()) return na.size()<nb.size() ? -1 : 1;
+        if (na!=nb) return na<nb ? -1 : 1;
+        std::string sa = alp(a,i), sb = alp(b,j);
+        if (sa!=sb){
+            // "1.2" < "1.2.1", mas "1.2rc1" < "1.2"
+            if (sa.empty()) return (sb=="." || sb=="-" || sb=="_") ? -1 : 1;
+            if (sb.empty()) return (sa=="." || sa=="-" || sa=="_") ? 1 : -1;
+            return sa<sb ? -1 : 1;
+        }
+    }
+    return 0;
+}
 
-    std::string cmd = (argc>=2) ? argv[1] : "help";
-    cmd = resolve_cmd(cmd);
+static bool is_prerelease(const std::string &v){
+    static const std::regex rx("(alpha|beta|rc|pre|dev|snapshot)", std::regex::icase);
+    return std::regex_search(v, rx);
+}
 
-    fs::path logpath = cfg.logs/"cbuild.log";
-    Logger log(logpath);
+static std::string regex_escape(const std::string &s){
+    static const std::regex special(R"([.^$|()\[\]{}*+?\\])");
+    return std::regex_replace(s, special, R"(\$&)");
+}
 
-    if (cmd=="help") { print_help(); return 0; }
+struct UpstreamCheck { std::string kind, target, pattern; };
 
-    auto need_name = [&](int minArgc){ if (argc<minArgc) { std::cerr << "Uso: "<<argv[0]<<" "<<cmd<<" <nome>\n"; return false;} return true; };
+static bool upstream_strategy(const Recipe &r, UpstreamCheck &uc){
+    if (!r.vcs.empty() && r.vcs.rfind("git:",0)==0){
+        uc = {"git", r.vcs.substr(4), ""};
+        return true;
+    }
+    auto urls = Recipe::split_list(r.url);
+    if (urls.empty()) return false;
+    std::string u = urls[0].substr(0, urls[0].find('|'));
+    auto slash = u.find_last_of('/');
+    if (slash==std::string::npos || r.version.empty()) return false;
+    std::string dir = u.substr(0, slash+1), file = u.substr(slash+1);
+    auto vp = file.find(r.version);
+    if (vp==std::string::npos) return false;
+    std::string vrx = "([0-9][0-9A-Za-z._]*?)";
+    // versão também no diretório: lista o diretório-pai e procura subdiretórios
+    std::string parent = dir.substr(0, dir.size()-1);
+    auto ps = parent.find_last_of('/');
+    std::string dname = ps==std::string::npos ? "" : parent.substr(ps+1);
+    auto dv = dname.find(r.version);
+    if (dv!=std::string::npos){
+        uc = {"dir", parent.substr(0, ps+1),
+              regex_escape(dname.substr(0,dv))+vrx+regex_escape(dname.substr(dv+r.version.size()))+"/"};
+        return true;
+    }
+    uc = {"http", dir, regex_escape(file.substr(0,vp))+vrx+regex_escape(file.substr(vp+r.version.size()))};
+    return true;
+}
 
-    try{
-        if (cmd=="init"){
-            if (!need_name(3)) return 1; return cmd_init(cfg, argv[2], log);
-        } else if (cmd=="fetch"){
-            if (!need_name(3)) return 1; Recipe r; if(ensure_recipe(cfg, argv[2], r, log)) return 1; return cmd_fetch(cfg,r,log);
-        } else if (cmd=="extract"){
-            if (!need_name(3)) return 1; Recipe r; if(ensure_recipe(cfg, argv[2], r, log)) return 1; return cmd_extract(cfg,r,log);
-        } else if (cmd=="patch"){
-            if (!need_name(3)) return 1; Recipe r; if(ensure_recipe(cfg, argv[2], r, log)) return 1; return cmd_patch(cfg,r,log);
-        } else if (cmd=="build"){
-            if (!need_name(3)) return 1; Recipe r; if(ensure_recipe(cfg, argv[2], r, log)) return 1; return cmd_build_all(cfg,r,log);
-        } else if (cmd=="install"){
-            if (!need_name(3)) return 1; Recipe r; if(ensure_recipe(cfg, argv[2], r, log)) return 1; return cmd_install(cfg,r,log);
-        } else if (cmd=="remove"){
-            if (!need_name(3)) return 1; Recipe r; if(ensure_recipe(cfg, argv[2], r, log)) return 1; return cmd_remove(cfg,r,log);
-        } else if (cmd=="info"){
-            if (!need_name(3)) return 1; Recipe r; if(ensure_recipe(cfg, argv[2], r, log)) return 1; return cmd_info(cfg,r,log);
-        } else if (cmd=="search"){
-            if (!need_name(3)) return 1; return cmd_search(cfg, argv[2], log);
-        } else if (cmd=="sync"){
-            return cmd_sync(cfg, log);
-        } else if (cmd=="revdep"){
-            if (!need_name(3)) return 1; Recipe r; if(ensure_recipe(cfg, argv[2], r, log)) return 1; return cmd_revdep(cfg,r,log);
-        } else if (cmd=="mkpkg"){
-            if (!need_name(3)) return 1; return cmd_mkpkg(cfg, argv[2], log);
+static std::vector<std::string> upstream_versions(const Config&c, const Recipe &r, const UpstreamCheck &uc){
+    std::vector<std::string> out;
+    std::string text;
+    if (uc.kind=="git"){
+        HostSlot slot(c, url_host(uc.target));
+        if (read_cmd("git ls-remote --tags --refs '"+uc.target+"' 2>/dev/null", text)) return out;
+        std::regex tagrx("refs/tags/(?:v|V|release-|"+regex_escape(r.name)+"[-_]?)?([0-9][0-9A-Za-z._-]*)");
+        std::stringstream ss(text); std::string line; std::smatch m;
+        while (std::getline(ss,line)) if (std::regex_search(line, m, tagrx)){
+            std::string v = m[1]; std::replace(v.begin(), v.end(), '_', '.');
+            out.push_back(v);
+        }
+        return out;
+    }
+    HostSlot slot(c, url_host(uc.target));
+    if (read_cmd("curl -sS -L --fail --max-time 30 '"+uc.target+"' 2>/dev/null", text)) return out;
+    std::regex rx(uc.pattern);
+    for (auto it = std::sregex_iterator(text.begin(), text.end(), rx); it!=std::sregex_iterator(); ++it)
+        out.push_back((*it)[1]);
+    return out;
+}
+
+struct OutdatedRow { std::string name, current, latest, kind; bool failed{false}; };
+
+static std::vector<OutdatedRow> check_upstream(const Config&c, bool refresh){
+    auto names = list_recipes(c);
+    fs::path cachef = c.base/"cache"/"outdated.tsv";
+    std::map<std::string, std::pair<long,std::string>> cache;   // chave da consulta -> (quando, mais nova)
+    {
+        std::ifstream in(cachef); std::string line;
+        while (std::getline(in,line)){
+            std::stringstream ss(line); std::string key, when, ver;
+            if (std::getline(ss,key,'\t') && std::getline(ss,when,'\t') && std::getline(ss,ver)) cache[key] = {std::atol(when.c_str()), ver};
+        }
+    }
+    std::mutex mtx;
+    std::vector<OutdatedRow> rows(names.size());
+    std::atomic<size_t> next{0};
+    long now = (long)time(nullptr);
+    std::vector<std::thread> pool;
+    for (int j=0; j<std::min<int>(c.outdated_jobs, (int)names.size()); ++j)
+        pool.emplace_back([&]{
+            for (size_t i; (i=next++)<names.size(); ){
+                OutdatedRow &row = rows[i]; row.name = names[i];
+                Recipe r;
+                try { r = Recipe::load_cached(recipe_ini(c, names[i]), recipe_cache_dir(c)); } catch (...) { row.failed=true; continue; }
+                row.current = r.version;
+                UpstreamCheck uc;
+                if (!upstream_strategy(r, uc)) { row.kind="-"; continue; }
+                row.kind = uc.kind;
+                std::string key = uc.kind+" "+uc.target+" "+uc.pattern;
+                {
+                    std::lock_guard<std::mutex> lk(mtx);
+                    auto it = cache.find(key);
+                    if (!refresh && it!=cache.end() && now-it->second.first < c.outdated_ttl) { row.latest = it->second.second; continue; }
+                }
+                auto vers = upstream_versions(c, r, uc);
+                std::string best;
+                for (auto &v: vers){
+                    if (is_prerelease(v) && !is_prerelease(r.version)) continue;
+                    if (best.empty() || version_cmp(v, best)>0) best = v;
+                }
+                if (best.empty()) { row.failed = true; continue; }
+                row.latest = best;
+                std::lock_guard<std::mutex> lk(mtx);
+                cache[key] = {now, best};
+            }
+        });
+    for (auto &t: pool) t.join();
+
+    fs::create_directories(cachef.parent_path());
+    std::ofstream out(cachef, std::ios::trunc);
+    for (auto &kv: cache) out << kv.first << '\t' << kv.second.first << '\t' << kv.second.second << "\n";
+    return rows;
+}
+
+static int cmd_outdated(const Config&c, bool all, bool refresh, Logger &log){
+    auto rows = check_upstream(c, refresh);
+    size_t w = 7; for (auto &r: rows) w = std::max(w, r.name.size());
+    int newer = 0;
+    std::cout << ansi::bold << std::left << std::setw(w+2) << "pacote" << std::setw(16) << "atual" << std::setw(16) << "upstream" << "via" << ansi::reset << "\n";
+    for (auto &r: rows){
+        bool up = !r.latest.empty() && version_cmp(r.latest, r.current)>0;
+        if (up) ++newer;
+        if (!all && !up) continue;
+        std::string latest = r.failed ? "?" : (r.latest.empty() ? "-" : r.latest);
+        std::cout << std::left << std::setw(w+2) << r.name << std::setw(16) << r.current
+                  << (up ? ansi::green : ansi::dim) << std::setw(16) << latest << ansi::reset << r.kind << "\n";
+    }
+    log.info(std::to_string(newer)+" de "+std::to_string(rows.size())+" receitas com versão nova upstream");
+    return 0;
+}
+
+// === bump: atualiza version=/url=/sha256= de receitas ===
+// As URLs são reescritas trocando a versão antiga pela nova; todos os arquivos das receitas
+// pedidas são baixados em paralelo (fetch_jobs) com o sha256 calculado durante o download.
+// Antes de gravar, os patches da receita são testados sobre as fontes novas.
+
+// troca chaves de [package] mantendo o resto do arquivo; chaves ausentes entram no fim da seção
+static bool rewrite_recipe_package(const fs::path &ini, std::map<std::string,std::string> kv){
+    std::ifstream in(ini); if (!in) return false;
+    std::vector<std::string> lines; std::string line, section;
+    int endOfPackage = -1;
+    while (std::getline(in,line)){
+        std::string t = line; t.erase(0, t.find_first_not_of(" \t"));
+        if (!t.empty() && t[0]=='['){
+            if (section=="package") endOfPackage = (int)lines.size();
+            section = t.substr(1, t.find(']')-1);
+        } else if (section=="package"){
+            auto pos = t.find('=');
+            std::string k = pos==std::string::npos ? "" : t.substr(0,pos);
+            k.erase(k.find_last_not_of(" \t")+1);
+            auto it = kv.find(k);
+            if (it!=kv.end()){ line = k+"="+it->second; kv.erase(it); }
+        }
+        lines.push_back(line);
+    }
+    if (section=="package") endOfPackage = (int)lines.size();
+    if (endOfPackage<0) return false;
+    // insere antes das linhas em branco que fecham a seção
+    while (endOfPackage>0 && lines[endOfPackage-1].find_first_not_of(" \t\r")==std::string::npos) --endOfPackage;
+    std::vector<std::string> extra;
+    for (auto &e: kv) extra.push_back(e.first+"="+e.second);
+    lines.insert(lines.begin()+endOfPackage, extra.begin(), extra.end());
+    fs::path tmp = ini; tmp += ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        for (auto &l: lines) out << l << "\n";
+        if (!out) return false;
+    }
+    fs::rename(tmp, ini);
+    return true;
+}
+
+// nome provisório que mantém a extensão (extract_members decide pelo sufixo)
+static fs::path bump_tmp(const fs::path &dst){ return dst.parent_path()/(".bump-"+dst.filename().string()); }
+
+static int cmd_bump(const Config&c, const std::vector<std::pair<std::string,std::string>> &targets,
+                    bool dry, bool force, Logger &log){
+    struct Job { Recipe r; std::string old, url; std::vector<std::string> urls, sums; std::vector<fs::path> dsts; std::string status; };
+    std::vector<Job> jobs;
+    for (auto &t: targets){
+        Job j;
+        if (ensure_recipe(c, t.first, j.r, log)) return 2;
+        if (j.r.version==t.second) { log.info(t.first+" já está em "+t.second); continue; }
+        j.old = j.r.version;
+        j.r.version = t.second;
+        if (!j.r.url.empty() && j.r.url.find(j.old)==std::string::npos) log.warn(t.first+": url= não contém a versão "+j.old);
+        j.url = replace_all(j.r.url, j.old, t.second);
+        j.r.url = j.url;
+        j.urls = archive_urls(j.r);
+        j.dsts = source_paths(c, j.r);
+        j.sums.assign(j.urls.size(), "");
+        jobs.push_back(std::move(j));
+    }
+    if (jobs.empty()) return 0;
+
+    fs::create_directories(c.sources);
+    std::vector<std::pair<size_t,size_t>> items;
+    for (size_t i=0;i<jobs.size();++i) for (size_t k=0;k<jobs[i].urls.size();++k) items.push_back({i,k});
+    std::vector<int> rcs(items.size(), 0);
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> pool;
+    for (int w=0; w<std::min<int>(c.fetch_jobs, (int)items.size()); ++w)
+        pool.emplace_back([&]{
+            for (size_t n; (n=next++)<items.size(); ){
+                // sempre baixa: um arquivo já em sources/ com o novo nome não foi conferido por
+                // receita alguma, então não serve de base para o sha256 gravado
+                auto &j = jobs[items[n].first]; size_t k = items[n].second;
+                rcs[n] = fetch_with_mirrors(c, j.urls[k], bump_tmp(j.dsts[k]), log, &j.sums[k]);
+            }
+        });
+    for (auto &t: pool) t.join();
+    for (size_t n=0;n<items.size();++n)
+        if (rcs[n] || jobs[items[n].first].sums[items[n].second].empty()) jobs[items[n].first].status = "download falhou";
+
+    int failed = 0;
+    std::error_code ec;
+    for (auto &j: jobs){
+        // o que foi baixado só vai para o nome definitivo quando a receita é regravada
+        auto settle=[&](bool keep){
+            for (auto &d: j.dsts){
+                if (keep && fs::exists(bump_tmp(d))) fs::rename(bump_tmp(d), d, ec);
+                else fs::remove(bump_tmp(d), ec);
+            }
+        };
+        if (j.status.empty() && !Recipe::split_list(j.r.patches).empty()){
+            std::vector<fs::path> staged;
+            for (auto &d: j.dsts) staged.push_back(bump_tmp(d));
+            auto res = check_patches_fresh(c, j.r, &staged);
+            for (auto &pc: res) if (pc.status==1) j.status = "patch não aplica: "+pc.patch;
+            if (!j.status.empty() && force) { log.warn(j.r.name+": "+j.status+" (--force)"); j.status.clear(); }
+        }
+        if (!j.status.empty()) { settle(false); ++failed; log.err(j.r.name+" "+j.old+" -> "+j.r.version+": "+j.status); continue; }
+        std::string sums;
+        for (size_t k=0;k<j.sums.size();++k) sums += (k?",":"")+j.sums[k];
+        if (dry) { settle(false); log.ok(j.r.name+" "+j.old+" -> "+j.r.version+" ok (dry-run) sha256="+sums); continue; }
+        std::map<std::string,std::string> kv{{"version", j.r.version}};
+        if (!j.url.empty()) { kv["url"] = j.url; kv["sha256"] = sums; }
+        if (!rewrite_recipe_package(recipe_ini(c, j.r.name), kv)) { settle(false); ++failed; log.err("Falha ao gravar receita: "+j.r.name); continue; }
+        settle(true);
+        log.ok(j.r.name+" "+j.old+" -> "+j.r.version);
+    }
+    return failed ? 1 : 0;
+}
+
+// === Fila de builds (base/queue.txt, um pacote por linha) ===
+static fs::path queue_file(const Config&c){ return c.base/"queue.txt"; }
+
+static std::vector<std::string> read_queue(const Config&c){
+    std::vector<std::string> q; std::ifstream in(queue_file(c)); std::string l;
+    while (std::getline(in,l)) if (!l.empty()) q.push_back(l);
+    return q;
+}
+
+// acrescenta sem duplicar; flock porque watch e queue --run podem rodar ao mesmo tempo
+static void enqueue(const Config&c, const std::vector<std::string> &names){
+    int fd = open((queue_file(c).string()+".lock").c_str(), O_CREAT|O_RDWR, 0644);
+    if (fd>=0) flock(fd, LOCK_EX);
+    auto q = read_queue(c);
+    std::set<std::string> have(q.begin(), q.end());
+    std::ofstream out(queue_file(c), std::ios::app);
+    for (auto &n: names) if (have.insert(n).second) out << n << "\n";
+    out.close();
+    if (fd>=0) { flock(fd, LOCK_UN); close(fd); }
+}
+
+static std::string pop_queue(const Config&c){
+    int fd = open((queue_file(c).string()+".lock").c_str(), O_CREAT|O_RDWR, 0644);
+    if (fd>=0) flock(fd, LOCK_EX);
+    auto q = read_queue(c);
+    std::string first = q.empty() ? "" : q.front();
+    if (!q.empty()){
+        std::ofstream out(queue_file(c), std::ios::trunc);
+        for (size_t i=1;i<q.size();++i) out << q[i] << "\n";
+    }
+    if (fd>=0) { flock(fd, LOCK_UN); close(fd); }
+    return first;
+}
+
+// fetch -> extract -> patch -> build -> install, cada etapa marcada no log da execução
+static int run_pipeline(const Config&c, const Recipe&r, Logger &log){
+    const std::vector<std::pair<std::string, int(*)(const Config&, const Recipe&, Logger&)>> steps = {
+        {"fetch", cmd_fetch}, {"extract", cmd_extract}, {"patch", cmd_patch}, {"build", cmd_build_all}, {"install", cmd_install}};
+    for (auto &st: steps){
+        log.phase(st.first);
+        int rc = run_at_prio(c.prio.at(st.first=="patch" ? "extract" : st.first), [&]{ return st.second(c, r, log); });
+        if (rc) { log.err(r.name+": "+st.first+" falhou (rc="+std::to_string(rc)+")"); return rc; }
+    }
+    return 0;
+}
+
+static int cmd_queue(const Config&c, bool run, bool clear, Logger &log){
+    if (clear) { std::ofstream(queue_file(c), std::ios::trunc); log.ok("Fila limpa"); return 0; }
+    if (!run) { for (auto &n: read_queue(c)) std::cout << n << "\n"; return 0; }
+    int failed = 0;
+    // não couberam agora: voltam para o fim da fila, na mesma ordem. A fila vem em ordem de
+    // dependências, então quem depende de um adiado também é adiado, para não ser construído
+    // contra uma dependência velha ou ausente
+    std::vector<std::string> deferred;
+    std::set<std::string> held;
+    CpuSlot placement;
+    for (std::string n; !(n = pop_queue(c)).empty(); ){
+        Recipe r;
+        if (ensure_recipe(c, n, r, log)) { ++failed; continue; }
+        auto deps = Recipe::split_list(r.depends);
+        auto blocker = std::find_if(deps.begin(), deps.end(), [&](const std::string &d){ return held.count(d)>0; });
+        if (blocker!=deps.end()) log.warn(n+" adiado: depende de "+*blocker+", que foi adiado");
+        if (blocker!=deps.end() || preflight(c, r, "all", false, log)) { deferred.push_back(n); held.insert(n); continue; }
+        log.begin_run(c.logs/r.name, "queue "+r.name+"-"+r.version, c.log_keep);
+        placement.apply(c, log);
+        if (run_pipeline(c, r, log)) ++failed;
+        log.end_run();
+    }
+    if (!deferred.empty()){
+        enqueue(c, deferred);
+        log.warn(std::to_string(deferred.size())+" item(ns) adiado(s) por falta de recursos, de volta à fila");
+    }
+    return failed ? 1 : deferred.empty() ? 0 : 75;
+}
+
+// === watch: inotify sobre recipes/ e repo/<nome>/ ===
+// Mantém o cache de receitas (cache/recipes) e o índice dos repositórios em dia a cada mudança,
+// inclusive em arquivos include=/inherit= compartilhados; com --enqueue põe na fila as receitas
+// alteradas e as que dependem delas (depends=), dependências primeiro.
+struct RecipeGraph {
+    std::map<std::string, Recipe> recipes;
+    std::map<std::string, std::set<std::string>> users;   // arquivo lido -> receitas que o usam
+
+    void load(const Config&c, const std::string &name){
+        forget(name);
+        fs::path ini = recipe_ini(c, name);
+        if (!fs::exists(ini)) return;
+        std::vector<fs::path> deps;
+        recipes[name] = Recipe::load_cached(ini, recipe_cache_dir(c), &deps);
+        for (auto &d: deps) users[d.string()].insert(name);
+    }
+    void forget(const std::string &name){
+        recipes.erase(name);
+        for (auto &u: users) u.second.erase(name);
+    }
+    // receitas que dependem (direta ou indiretamente) de `names`, em ordem topológica
+    std::vector<std::string> with_dependents(const std::set<std::string> &names) const {
+        std::map<std::string, std::vector<std::string>> rdeps;
+        for (auto &kv: recipes) for (auto &d: Recipe::split_list(kv.second.depends)) rdeps[d].push_back(kv.first);
+        std::set<std::string> all(names.begin(), names.end());
+        std::vector<std::string> stack(names.begin(), names.end());
+        while (!stack.empty()){
+            auto n = stack.back(); stack.pop_back();
+            for (auto &u: rdeps[n]) if (all.insert(u).second) stack.push_back(u);
+        }
+        std::vector<std::string> order; std::set<std::string> seen;
+        std::function<void(const std::string&)> visit = [&](const std::string &n){
+            if (!seen.insert(n).second) return;
+            auto it = recipes.find(n);
+            if (it!=recipes.end()) for (auto &d: Recipe::split_list(it->second.depends)) if (all.count(d)) visit(d);
+            order.push_back(n);
+        };
+        for (auto &n: all) visit(n);
+        return order;
+    }
+};
+
+static int cmd_watch(const Config&c, bool doEnqueue, int debounceMs, Logger &log){
+    int fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+    if (fd<0) { log.err("inotify indisponível"); return 1; }
+    const uint32_t mask = IN_CLOSE_WRITE|IN_MOVED_TO|IN_MOVED_FROM|IN_CREATE|IN_DELETE|IN_DELETE_SELF;
+    std::map<int, fs::path> wd2dir;
+    std::function<void(const fs::path&)> watch_tree = [&](const fs::path &dir){
+        int wd = inotify_add_watch(fd, dir.c_str(), mask);
+        if (wd>=0) wd2dir[wd] = dir;
+        std::error_code ec;
+        for (auto &e: fs::directory_iterator(dir, ec))
+            if (e.is_directory() && e.path().filename()!=".git") watch_tree(e.path());
+    };
+    std::vector<std::pair<fs::path, std::string>> roots{{c.recipes, ""}};   // raiz -> repo ("" = local)
+    for (auto &r: c.repos) roots.push_back({c.repo/r.name, r.name});
+    for (auto &rt: roots) if (fs::exists(rt.first)) watch_tree(rt.first);
+
+    auto t0 = std::chrono::steady_clock::now();
+    RecipeGraph g;
+    for (auto &n: list_recipes(c)) { try { g.load(c, n); } catch (const std::exception &e) { log.warn(n+": "+e.what()); } }
+    long ms0 = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now()-t0).count();
+    log.info("watch: "+std::to_string(g.recipes.size())+" receitas, "+std::to_string(wd2dir.size())+" diretórios ("+std::to_string(ms0)+" ms)");
+
+    std::set<fs::path> pending;
+    char buf[64*1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;){
+        pollfd pfd{fd, POLLIN, 0};
+        int pr = poll(&pfd, 1, pending.empty() ? -1 : debounceMs);
+        if (pr<0) { if (errno==EINTR) continue; break; }
+        if (pr>0){
+            ssize_t n;
+            while ((n = read(fd, buf, sizeof buf)) > 0){
+                for (char *p=buf; p<buf+n; ){
+                    auto *ev = (struct inotify_event*)p;
+                    p += sizeof(struct inotify_event) + ev->len;
+                    auto it = wd2dir.find(ev->wd);
+                    if (it==wd2dir.end()) continue;
+                    if (ev->mask & (IN_IGNORED|IN_DELETE_SELF)) { if (ev->mask & IN_IGNORED) wd2dir.erase(it); continue; }
+                    fs::path path = ev->len ? it->second/ev->name : it->second;
+                    if (path.filename()==".git" || path.string().find(".tmp")!=std::string::npos) continue;
+                    if ((ev->mask & IN_ISDIR) && (ev->mask & (IN_CREATE|IN_MOVED_TO))) watch_tree(path);
+                    pending.insert(path);
+                }
+            }
+            continue;   // espera o silêncio (debounce) antes de processar
+        }
+        // debounce expirou: resolve arquivos alterados em receitas
+        auto t1 = std::chrono::steady_clock::now();
+        std::set<std::string> changed;
+        std::set<std::string> indexDirty;
+        auto idxNow = c.repos.empty() ? decltype(read_recipe_index(c)){} : read_recipe_index(c);
+        for (auto &path: pending){
+            for (auto &rt: roots){
+                auto rel = path.lexically_relative(rt.first);
+                if (rel.empty() || *rel.begin()==".." || rel==".") continue;
+                std::string name = rel.begin()->string();
+                bool isRecipe = fs::exists(rt.first/name/"recipe.ini");
+                if (!rt.second.empty() && (idxNow[rt.second].count(name)>0)!=isRecipe) indexDirty.insert(rt.second+"\t"+name);
+                if (isRecipe || g.recipes.count(name)) changed.insert(name);
+            }
+            auto u = g.users.find(fs::absolute(path).string());
+            if (u!=g.users.end()) changed.insert(u->second.begin(), u->second.end());
+        }
+        pending.clear();
+        if (!indexDirty.empty()){
+            auto idx = read_recipe_index(c);
+            for (auto &e: indexDirty){
+                auto tab = e.find('\t'); std::string repo = e.substr(0,tab), name = e.substr(tab+1);
+                if (fs::exists(c.repo/repo/name/"recipe.ini")) idx[repo].insert(name); else idx[repo].erase(name);
+            }
+            write_recipe_index(c, idx);
+            repo_recipe_map(c, true);
+        }
+        if (changed.empty()) continue;
+        std::set<std::string> live;
+        for (auto &n: changed){
+            try { g.load(c, n); } catch (const std::exception &e) { log.warn(n+": "+e.what()); g.forget(n); continue; }
+            if (g.recipes.count(n)) live.insert(n); else log.info("watch: receita removida: "+n);
+        }
+        long ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now()-t1).count();
+        std::string list; for (auto &n: live) list += " "+n;
+        if (!live.empty()) log.ok("watch: recarregadas ("+std::to_string(ms)+" ms):"+list);
+        if (doEnqueue && !live.empty()){
+            auto order = g.with_dependents(live);
+            enqueue(c, order);
+            std::string ol; for (auto &n: order) ol += " "+n;
+            log.info("watch: na fila:"+ol);
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+// === plan: simulação do que um build faria, sem executar nada ===
+// Decide por pacote (e dependências via depends=) quais etapas precisam rodar, estima cada uma
+// pelo histórico em logs/timings.tsv e simula a execução com N jobs (escalonamento por lista,
+// prioridade para o caminho mais longo até o fim).
+static const std::vector<std::string> plan_stages = {"fetch","extract","patch","build","install"};
+
+struct StageTime { double wall{0}, cpu{0}; };
+
+// mediana das últimas 5 execuções de cada etapa; "*" guarda a mediana geral por etapa
+static std::map<std::string, std::map<std::string, StageTime>> load_timings(const Config&c){
+    std::map<std::string, std::map<std::string, std::vector<StageTime>>> hist;
+    std::ifstream in(c.logs/"timings.tsv");
+    std::string line;
+    while (std::getline(in,line)){
+        std::istringstream ss(line); std::string pkg, st; StageTime t;
+        if (std::getline(ss,pkg,'\t') && std::getline(ss,st,'\t') && ss >> t.wall >> t.cpu) hist[pkg][st].push_back(t);
+    }
+    auto median=[](std::vector<StageTime> v){
+        auto mid = [](std::vector<double> x){ std::sort(x.begin(), x.end()); return x.empty() ? 0.0 : x[x.size()/2]; };
+        std::vector<double> w, cpu;
+        for (auto &t: v) { w.push_back(t.wall); cpu.push_back(t.cpu); }
+        return StageTime{mid(w), mid(cpu)};
+    };
+    std::map<std::string, std::map<std::string, StageTime>> out;
+    std::map<std::string, std::vector<StageTime>> all;
+    for (auto &p: hist) for (auto &s: p.second){
+        std::vector<StageTime> last(s.second.end()-std::min<size_t>(5, s.second.size()), s.second.end());
+        all[s.first].push_back(out[p.first][s.first] = median(last));
+    }
+    for (auto &s: all) out["*"][s.first] = median(s.second);
+    return out;
+}
+
+struct PlanNode {
+    Recipe r;
+    std::vector<std::string> stages, reasons, deps, users;
+    double wall{0}, cpu{0}, start{0}, finish{0}, tail{0};
+    bool guessed{false};
+};
+
+static std::string fmt_secs(double s){
+    long n = std::lround(s);
+    char buf[32];
+    if (n>=3600) snprintf(buf, sizeof buf, "%ldh%02ldm", n/3600, n/60%60);
+    else if (n>=60) snprintf(buf, sizeof buf, "%ldm%02lds", n/60, n%60);
+    else snprintf(buf, sizeof buf, "%lds", n);
+    return buf;
+}
+
+static std::string json_str(const std::string &s){
+    std::string o = "\"";
+    for (char ch: s){ if (ch=='"' || ch=='\\') o += '\\'; if ((unsigned char)ch<0x20) { o += ' '; continue; } o += ch; }
+    return o + "\"";
+}
+
+static int cmd_plan(const Config&c, std::vector<std::string> names, int jobs, const std::string &format, Logger &log){
+    if (names.empty()) names = list_recipes(c);
+    RecipeGraph g;
+    for (std::vector<std::string> stack(names.begin(), names.end()); !stack.empty(); ){
+        auto n = stack.back(); stack.pop_back();
+        if (g.recipes.count(n)) continue;
+        g.load(c, n);
+        if (!g.recipes.count(n)) { log.err("Receita não encontrada: "+n); return 1; }
+        for (auto &d: Recipe::split_list(g.recipes[n].depends)) stack.push_back(d);
+    }
+    // ordem topológica, dependências primeiro
+    std::vector<std::string> order;
+    std::map<std::string,int> mark;
+    std::function<bool(const std::string&)> visit = [&](const std::string &n){
+        if (mark[n]==2) return true;
+        if (mark[n]==1) { log.err("Ciclo em depends= envolvendo "+n); return false; }
+        mark[n] = 1;
+        for (auto &d: Recipe::split_list(g.recipes[n].depends)) if (!visit(d)) return false;
+        mark[n] = 2; order.push_back(n);
+        return true;
+    };
+    for (auto &kv: g.recipes) if (!visit(kv.first)) return 1;
+
+    auto timings = load_timings(c);
+    std::map<std::string, PlanNode> nodes;
+    for (auto &n: order){
+        PlanNode &pn = nodes[n];
+        pn.r = g.recipes[n];
+        const Recipe &r = pn.r;
+        bool missing = false;
+        for (auto &p: source_paths(c,r)) missing |= !fs::exists(p);
+        if (r.vcs.rfind("git:",0)==0) missing |= !fs::exists(c.sources/(r.name+"-git"));
+        fs::path manf = install_manifest(c,r);
+        bool rebuild = false;
+        std::error_code ec;
+        if (!fs::exists(manf) || !fs::exists(destdir_pkg(c,r))) { rebuild = true; pn.reasons.push_back("não instalado"); }
+        else {
+            auto built = fs::last_write_time(manf, ec);
+            std::string fp;
+            std::ifstream st(recipe_stamp(c,r)); std::getline(st, fp);
+            bool changed = !fp.empty() && fp!=r.fingerprint();
+            // instalações antigas sem .recipe: compara com o mtime dos arquivos da receita
+            if (fp.empty()) for (auto &u: g.users) if (u.second.count(n) && fs::last_write_time(u.first, ec)>built) changed = true;
+            if (changed) { rebuild = true; pn.reasons.push_back("receita mudou"); }
+            for (auto &d: Recipe::split_list(r.depends)){
+                const PlanNode &dn = nodes[d];
+                if (!dn.stages.empty()) { rebuild = true; pn.reasons.push_back("dependência "+d+" será refeita"); }
+                else if (fs::last_write_time(install_manifest(c, dn.r), ec)>built) { rebuild = true; pn.reasons.push_back("dependência "+d+" mais nova"); }
+            }
+        }
+        if (!rebuild) continue;
+        if (missing) pn.reasons.push_back("fontes ausentes");
+        for (auto &st: plan_stages){
+            if (st=="fetch" && !missing) continue;
+            pn.stages.push_back(st);
+            auto &hp = timings[n];
+            if (hp.count(st)) { pn.wall += hp[st].wall; pn.cpu += hp[st].cpu; }
+            else { pn.guessed = true; pn.wall += timings["*"][st].wall; pn.cpu += timings["*"][st].cpu; }
+        }
+    }
+    // grafo só com o que será refeito
+    std::vector<std::string> work;
+    for (auto &n: order) if (!nodes[n].stages.empty()) work.push_back(n);
+    for (auto &n: work) for (auto &d: Recipe::split_list(nodes[n].r.depends))
+        if (!nodes[d].stages.empty()) { nodes[n].deps.push_back(d); nodes[d].users.push_back(n); }
+
+    // caminho crítico: maior soma de durações em uma cadeia de dependências
+    double cpuTotal = 0, critical = 0;
+    std::map<std::string, std::pair<double,std::string>> ef;   // término mais cedo, antecessor
+    std::string critEnd;
+    for (auto &n: work){
+        auto &pn = nodes[n];
+        std::pair<double,std::string> best{0, ""};
+        for (auto &d: pn.deps) if (ef[d].first>best.first) best = {ef[d].first, d};
+        ef[n] = {best.first+pn.wall, best.second};
+        if (ef[n].first>=critical) { critical = ef[n].first; critEnd = n; }
+        cpuTotal += pn.cpu;
+    }
+    std::vector<std::string> critPath;
+    for (std::string n = critEnd; !n.empty(); n = ef[n].second) critPath.insert(critPath.begin(), n);
+    for (auto it = work.rbegin(); it!=work.rend(); ++it){
+        auto &pn = nodes[*it];
+        for (auto &u: pn.users) pn.tail = std::max(pn.tail, nodes[u].tail);
+        pn.tail += pn.wall;
+    }
+
+    // simulação com `jobs` slots: sempre inicia o pronto com a maior cauda
+    jobs = std::max(1, jobs);
+    std::map<std::string,size_t> pending;
+    std::vector<std::string> ready;
+    for (auto &n: work) if (!(pending[n] = nodes[n].deps.size())) ready.push_back(n);
+    std::priority_queue<std::pair<double,std::string>, std::vector<std::pair<double,std::string>>, std::greater<>> running;
+    double now = 0, wallTotal = 0;
+    while (!ready.empty() || !running.empty()){
+        while ((int)running.size()<jobs && !ready.empty()){
+            auto it = std::max_element(ready.begin(), ready.end(), [&](auto &a, auto &b){ return nodes[a].tail<nodes[b].tail; });
+            auto &pn = nodes[*it];
+            pn.start = now; pn.finish = now+pn.wall;
+            running.push({pn.finish, *it});
+            ready.erase(it);
+        }
+        auto [t, n] = running.top(); running.pop();
+        now = wallTotal = t;
+        for (auto &u: nodes[n].users) if (--pending[u]==0) ready.push_back(u);
+    }
+
+    bool anyGuess = false;
+    for (auto &n: work) anyGuess |= nodes[n].guessed;
+    std::set<std::string> onCrit(critPath.begin(), critPath.end());
+    auto jlist=[&](const std::vector<std::string> &v){
+        std::string o = "[";
+        for (size_t i=0;i<v.size();++i) o += (i?",":"") + json_str(v[i]);
+        return o + "]";
+    };
+    if (format=="json"){
+        std::cout << std::fixed << std::setprecision(1)
+                  << "{\"jobs\":" << jobs << ",\"cpu_secs\":" << cpuTotal << ",\"critical_path_secs\":" << critical
+                  << ",\"wall_secs\":" << wallTotal << ",\"critical_path\":" << jlist(critPath) << ",\"packages\":[";
+        for (size_t i=0;i<work.size();++i){
+            auto &pn = nodes[work[i]];
+            std::cout << (i?",":"") << "{\"name\":" << json_str(pn.r.name) << ",\"version\":" << json_str(pn.r.version)
+                      << ",\"stages\":" << jlist(pn.stages) << ",\"reasons\":" << jlist(pn.reasons) << ",\"depends\":" << jlist(pn.deps)
+                      << ",\"est_secs\":" << pn.wall << ",\"cpu_secs\":" << pn.cpu << ",\"estimated\":" << (pn.guessed?"true":"false")
+                      << ",\"start\":" << pn.start << ",\"finish\":" << pn.finish << "}";
+        }
+        std::cout << "]}\n";
+        return 0;
+    }
+    if (format=="dot"){
+        std::cout << "digraph plan {\n  rankdir=LR;\n  node [shape=box];\n";
+        for (auto &n: work){
+            auto &pn = nodes[n];
+            std::cout << "  " << json_str(n) << " [label=" << json_str(pn.r.name+"-"+pn.r.version+"\\n"+(pn.guessed?"~":"")+fmt_secs(pn.wall))
+                      << (onCrit.count(n) ? ", color=red, penwidth=2" : "") << "];\n";
+        }
+        for (auto &n: work) for (auto &d: nodes[n].deps)
+            std::cout << "  " << json_str(d) << " -> " << json_str(n) << (onCrit.count(n) && ef[n].second==d ? " [color=red, penwidth=2]" : "") << ";\n";
+        std::cout << "}\n";
+        return 0;
+    }
+    if (work.empty()) { log.ok("Tudo em dia ("+std::to_string(order.size())+" receitas)"); return 0; }
+    for (auto &n: work){
+        auto &pn = nodes[n];
+        std::string st;
+        for (auto &s: pn.stages) st += (st.empty()?"":",") + s;
+        std::string why;
+        for (auto &s: pn.reasons) why += (why.empty()?"":"; ") + s;
+        std::cout << (onCrit.count(n) ? "* " : "  ") << std::left << std::setw(24) << (pn.r.name+"-"+pn.r.version)
+                  << std::setw(34) << st << std::setw(9) << ((pn.guessed?"~":"")+fmt_secs(pn.wall)) << why << "\n";
+    }
+    std::string cp;
+    for (auto &n: critPath) cp += (cp.empty()?"":" -> ") + n;
+    std::cout << "\n" << work.size() << " pacote(s) a refazer, " << (order.size()-work.size()) << " em dia\n"
+              << "CPU estimada:      " << fmt_secs(cpuTotal) << "\n"
+              << "Caminho crítico:   " << fmt_secs(critical) << " (" << cp << ")\n"
+              << "Tempo com " << jobs << " job(s): " << fmt_secs(wallTotal) << "\n";
+    if (anyGuess) std::cout << "(~ = sem histórico próprio; usa a mediana das outras receitas)\n";
+    return 0;
+}
+
+// DESTDIR instalada com o .sums em dia (reescrito se o manifest for mais novo)
+static bool installed_sums(const Config&c, const Recipe&r, Logger &log){
+    fs::path dest = destdir_pkg(c,r), sums = sums_file(c,r);
+    if (!fs::exists(install_manifest(c,r)) || !fs::exists(dest)) { log.err(r.name+": não instalado (rode install)"); return false; }
+    std::error_code ec;
+    if (!fs::exists(sums) || fs::last_write_time(sums, ec) < fs::last_write_time(install_manifest(c,r), ec)) write_sums(dest, sums, log);
+    return true;
+}
+
+// tar determinístico (ordem da lista, mtime 0, dono 0:0, sem atime/ctime) lendo nomes de -T NUL-separado
+static const char *det_tar = "tar --format=posix --pax-option=exthdr.name=%d/PaxHeaders/%f,delete=atime,delete=ctime"
+                             " --mtime=@0 --owner=0 --group=0 --numeric-owner --no-recursion --null -cf -";
+
+// lista para det_tar: diretórios pais + entradas do .sums, em ordem de bytes
+static void sums_tar_list(const fs::path &sums, const fs::path &list){
+    std::set<std::string> names;
+    std::ifstream in(sums); std::string line;
+    while (std::getline(in, line)){
+        std::string rel = line.substr(0, line.find('\t'));
+        for (fs::path p = fs::path(rel).parent_path(); !p.empty(); p = p.parent_path()) names.insert(p.string());
+        names.insert(rel);
+    }
+    std::ofstream lo(list, std::ios::binary);
+    for (auto &n: names) lo << "./" << n << '\0';
+}
+
+// === export-oci: layout OCI a partir das DESTDIRs instaladas ===
+// Uma camada por argumento (pacotes unidos com "+" viram uma camada só). O tar é determinístico
+// (ordem por nome, mtime 0, dono 0:0) e montado da lista do .sums, então a mesma instalação gera
+// sempre o mesmo blob; camadas já feitas ficam em base/oci (chave = .sums + compressão) e são
+// só ligadas ao layout de destino.
+struct OciBlob { std::string digest, mediaType; uintmax_t size{0}; };
+
+static std::string oci_arch(){
+    struct utsname u{};
+    uname(&u);
+    std::string m = u.machine;
+    return m=="x86_64" ? "amd64" : m=="aarch64" ? "arm64" : m.rfind("armv7",0)==0 ? "arm" : m=="i686" ? "386" : m;
+}
+
+// copia (ou liga) o blob do armazém para <layout>/blobs/sha256
+static bool oci_link_blob(const fs::path &store, const fs::path &layout, const std::string &digest){
+    fs::path src = store/"blobs"/"sha256"/digest.substr(7), dst = layout/"blobs"/"sha256"/digest.substr(7);
+    std::error_code ec;
+    if (fs::exists(dst, ec)) return true;
+    fs::create_directories(dst.parent_path(), ec);
+    fs::create_hard_link(src, dst, ec);
+    if (ec) { ec.clear(); fs::copy_file(src, dst, ec); }
+    return !ec;
+}
+
+static OciBlob oci_put_json(const fs::path &store, const fs::path &layout, const std::string &mediaType, const std::string &json){
+    OciBlob b{"sha256:"+sha256::str(json), mediaType, json.size()};
+    fs::path p = store/"blobs"/"sha256"/b.digest.substr(7);
+    fs::create_directories(p.parent_path());
+    if (!fs::exists(p)) std::ofstream(p, std::ios::binary) << json;
+    oci_link_blob(store, layout, b.digest);
+    return b;
+}
+
+static int cmd_export_oci(const Config&c, const fs::path &layout, const std::vector<std::string> &groups,
+                          const std::string &tag, bool gzip, Logger &log){
+    fs::path store = c.base/"oci";
+    fs::create_directories(store/"blobs"/"sha256");
+    fs::create_directories(layout/"blobs"/"sha256");
+    bool pigz = gzip && have_tool("pigz");
+    std::string comp = gzip ? (pigz ? "pigz -n -c" : "gzip -n -c") : "zstd -T0 -q -c";
+    std::string layerType = gzip ? "application/vnd.oci.image.layer.v1.tar+gzip" : "application/vnd.oci.image.layer.v1.tar+zstd";
+
+    // cache de camadas: chave -> diff_id, digest, tamanho
+    fs::path cacheFile = store/"layers.tsv";
+    std::map<std::string, std::array<std::string,3>> cache;
+    {
+        std::ifstream in(cacheFile); std::string k, d, g, s;
+        while (in >> k >> d >> g >> s) cache[k] = {d, g, s};
+    }
+    std::vector<OciBlob> layers;
+    std::vector<std::string> diffIds, history;
+    for (auto &grp: groups){
+        std::vector<Recipe> pkgs;
+        std::string key = comp, label;
+        std::vector<std::string> names;
+        std::stringstream gs(grp);
+        for (std::string n; std::getline(gs, n, '+'); ) if (!n.empty()) names.push_back(n);
+        for (auto &n: names){
+            Recipe r;
+            if (ensure_recipe(c, n, r, log)) return 1;
+            if (!installed_sums(c, r, log)) return 1;
+            std::ifstream in(sums_file(c,r)); std::stringstream ss; ss << in.rdbuf();
+            key += "\n"+r.name+"-"+r.version+"\n"+ss.str();
+            label += (label.empty()?"":" + ")+r.name+"-"+r.version;
+            pkgs.push_back(r);
+        }
+        key = sha256::str(key);
+        auto it = cache.find(key);
+        if (it!=cache.end() && fs::exists(store/"blobs"/"sha256"/it->second[1].substr(7))){
+            log.info("camada reaproveitada: "+label);
+        } else {
+            fs::path tmp = store/("tmp-"+std::to_string(getpid()));
+            fs::create_directories(tmp);
+            std::string tarCmd = det_tar;
+            for (size_t i=0;i<pkgs.size();++i){
+                fs::path list = tmp/("list"+std::to_string(i));
+                sums_tar_list(sums_file(c, pkgs[i]), list);
+                tarCmd += " -C '"+destdir_pkg(c, pkgs[i]).string()+"' -T '"+list.string()+"'";
+            }
+            fs::path tarFile = tmp/"layer.tar", blobTmp = tmp/"layer.blob";
+            int rc = exec_cmd("bash -c \"set -o pipefail; "+tarCmd+" > '"+tarFile.string()+"' && "+comp+" < '"+tarFile.string()+"' > '"+blobTmp.string()+"'\"", log, false);
+            if (rc) { fs::remove_all(tmp); log.err("falha ao gerar camada: "+label); return rc; }
+            std::string diff = "sha256:"+sha256::file(tarFile), dig = "sha256:"+sha256::file(blobTmp);
+            std::error_code ec;
+            uintmax_t size = fs::file_size(blobTmp, ec);
+            fs::rename(blobTmp, store/"blobs"/"sha256"/dig.substr(7), ec);
+            fs::remove_all(tmp, ec);
+            cache[key] = {diff, dig, std::to_string(size)};
+            std::ofstream(cacheFile, std::ios::app) << key << ' ' << diff << ' ' << dig << ' ' << size << "\n";
+            it = cache.find(key);
+            log.ok("camada "+label+": "+dig.substr(0,19)+" ("+human_bytes(size)+")");
+        }
+        if (!oci_link_blob(store, layout, it->second[1])) { log.err("não foi possível copiar blob para "+layout.string()); return 1; }
+        layers.push_back({it->second[1], layerType, (uintmax_t)std::stoull(it->second[2])});
+        diffIds.push_back(it->second[0]);
+        history.push_back(label);
+    }
+
+    // config e manifest sem datas, para o mesmo conjunto dar o mesmo digest
+    std::string cfg = "{\"architecture\":"+json_str(oci_arch())+",\"os\":\"linux\",\"config\":{\"Env\":"
+        "[\"PATH=/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin\"]},\"rootfs\":{\"type\":\"layers\",\"diff_ids\":[";
+    for (size_t i=0;i<diffIds.size();++i) cfg += (i?",":"")+json_str(diffIds[i]);
+    cfg += "]},\"history\":[";
+    for (size_t i=0;i<history.size();++i) cfg += std::string(i?",":"")+"{\"created_by\":"+json_str("cbuild "+history[i])+"}";
+    cfg += "]}";
+    OciBlob cb = oci_put_json(store, layout, "application/vnd.oci.image.config.v1+json", cfg);
+    auto desc=[](const OciBlob &b){
+        return "{\"mediaType\":"+json_str(b.mediaType)+",\"digest\":"+json_str(b.digest)+",\"size\":"+std::to_string(b.size)+"}";
+    };
+    std::string man = "{\"schemaVersion\":2,\"mediaType\":\"application/vnd.oci.image.manifest.v1+json\",\"config\":"+desc(cb)+",\"layers\":[";
+    for (size_t i=0;i<layers.size();++i) man += (i?",":"")+desc(layers[i]);
+    man += "]}";
+    OciBlob mb = oci_put_json(store, layout, "application/vnd.oci.image.manifest.v1+json", man);
+
+    // index.json com todas as tags exportadas para este layout (guardadas em cbuild-tags.tsv)
+    std::map<std::string, std::pair<std::string,uintmax_t>> tags;
+    {
+        std::ifstream in(layout/"cbuild-tags.tsv"); std::string t, d; uintmax_t s;
+        while (in >> t >> d >> s) tags[t] = {d, s};
+    }
+    tags[tag] = {mb.digest, mb.size};
+    std::ofstream(layout/"cbuild-tags.tsv", std::ios::trunc) << [&]{
+        std::string o; for (auto &t: tags) o += t.first+"\t"+t.second.first+"\t"+std::to_string(t.second.second)+"\n"; return o; }();
+    std::string idx = "{\"schemaVersion\":2,\"mediaType\":\"application/vnd.oci.image.index.v1+json\",\"manifests\":[";
+    bool first = true;
+    for (auto &t: tags){
+        idx += std::string(first?"":",")+"{\"mediaType\":\"application/vnd.oci.image.manifest.v1+json\",\"digest\":"+json_str(t.second.first)+
+               ",\"size\":"+std::to_string(t.second.second)+",\"annotations\":{\"org.opencontainers.image.ref.name\":"+json_str(t.first)+"}}";
+        first = false;
+    }
+    idx += "]}";
+    std::ofstream(layout/"index.json", std::ios::trunc) << idx;
+    std::ofstream(layout/"oci-layout", std::ios::trunc) << "{\"imageLayoutVersion\":\"1.0.0\"}";
+    log.ok("Imagem "+tag+" em "+layout.string()+": "+std::to_string(layers.size())+" camada(s), manifest "+mb.digest.substr(0,19));
+    return 0;
+}
+
+// === export-image: imagem SquashFS/EROFS somente leitura com as DESTDIRs de vários pacotes ===
+// A árvore unificada é montada com hardlinks a partir das DESTDIRs (sem copiar dados); arquivos
+// idênticos entre pacotes (mesmo sha256 e modo no .sums) viram um só inode, que o construtor grava
+// uma vez. O construtor é externo (mksquashfs ou mkfs.erofs) com datas e donos fixos.
+// Com --tree a árvore fica para o usuário: é copiada (hardlinks para as DESTDIRs fariam uma edição
+// nela alterar os pacotes instalados) e só é gerada num diretório novo ou vazio.
+static int cmd_export_image(const Config&c, const fs::path &out, const std::vector<std::string> &names,
+                            const std::string &format, const std::string &treeOnly, Logger &log){
+    std::vector<Recipe> pkgs;
+    std::string key = format;
+    for (auto &n: names){
+        Recipe r;
+        if (ensure_recipe(c, n, r, log)) return 1;
+        if (!installed_sums(c, r, log)) return 1;
+        std::ifstream in(sums_file(c,r)); std::stringstream ss; ss << in.rdbuf();
+        key += "\n"+r.name+"-"+r.version+"\n"+ss.str();
+        pkgs.push_back(r);
+    }
+    key = sha256::str(key);
+    fs::path stamp = out; stamp += ".cbuild";
+    if (treeOnly.empty() && fs::exists(out)){
+        std::string old; std::ifstream(stamp) >> old;
+        if (old==key) { log.ok("Imagem já atualizada: "+out.string()); return 0; }
+    }
+    std::string builder = format=="erofs" ? "mkfs.erofs" : "mksquashfs";
+    if (treeOnly.empty() && !have_tool(builder)) {
+        log.err(builder+" não encontrado (instale "+(format=="erofs" ? "erofs-utils" : "squashfs-tools")+"; --tree DIR gera só a árvore)");
+        return 1;
+    }
+
+    fs::path stage = treeOnly.empty() ? c.work/(".image-"+std::to_string(getpid())) : fs::path(treeOnly);
+    std::error_code ec;
+    if (!treeOnly.empty() && fs::exists(stage) && (!fs::is_directory(stage) || !fs::is_empty(stage))){
+        log.err(stage.string()+" já existe e não está vazio (--tree precisa de um diretório novo ou vazio)");
+        return 1;
+    }
+    if (treeOnly.empty()) fs::remove_all(stage, ec);
+    fs::create_directories(stage);
+    // dono final de cada caminho primeiro (pacote posterior sobrescreve); só os que sobram
+    // entram na árvore e na deduplicação
+    struct Ent { fs::path src; std::string mode, size, sum; };
+    std::map<std::string, Ent> final;
+    for (auto &r: pkgs){
+        fs::path dest = destdir_pkg(c,r);
+        std::ifstream in(sums_file(c,r)); std::string line;
+        while (std::getline(in, line)){
+            std::istringstream ls(line); std::string rel, mode, size, sum;
+            if (!std::getline(ls, rel, '\t') || !std::getline(ls, mode, '\t') || !std::getline(ls, size, '\t') || !std::getline(ls, sum, '\t')) continue;
+            final[rel] = {dest/rel, mode, size, sum};
+        }
+    }
+    std::map<std::string, fs::path> seen;   // sha256+modo -> primeiro arquivo na árvore
+    uintmax_t saved = 0; size_t files = 0, dups = 0;
+    for (auto &f: final){
+        const std::string &rel = f.first;
+        const Ent &e = f.second;
+        fs::path dst = stage/rel;
+        fs::create_directories(dst.parent_path(), ec);
+        mode_t m = std::stoul(e.mode, nullptr, 8);
+        if (S_ISLNK(m)) { fs::create_symlink(fs::read_symlink(e.src, ec), dst, ec); continue; }
+        ++files;
+        auto it = seen.find(e.sum+e.mode);
+        bool dup = it!=seen.end();
+        ec.clear();
+        if (dup || treeOnly.empty()) fs::create_hard_link(dup ? it->second : e.src, dst, ec);
+        if (ec || (!dup && !treeOnly.empty())) { ec.clear(); fs::copy_file(dup ? it->second : e.src, dst, ec); }
+        if (ec) { log.err("falha ao montar "+rel+": "+ec.message()); fs::remove_all(stage, ec); return 1; }
+        if (dup) { ++dups; saved += std::stoull(e.size); }
+        else seen[e.sum+e.mode] = dst;
+    }
+    log.info(std::to_string(files)+" arquivos, "+std::to_string(dups)+" duplicados ("+human_bytes(saved)+" a menos)");
+    if (!treeOnly.empty()) { log.ok("Árvore unificada em "+stage.string()); return 0; }
+
+    fs::path tmp = out; tmp += ".tmp";
+    fs::remove(tmp, ec);
+    std::string cmd = format=="erofs"
+        ? "mkfs.erofs -zlz4hc -T0 --all-root -Ededupe '"+tmp.string()+"' '"+stage.string()+"'"
+        : "mksquashfs '"+stage.string()+"' '"+tmp.string()+"' -noappend -comp zstd -all-root -mkfs-time 0 -all-time 0 -quiet";
+    int rc = exec_cmd(cmd, log);
+    discard_tree(c, stage);
+    if (rc) { fs::remove(tmp, ec); return rc; }
+    fs::rename(tmp, out, ec);
+    std::ofstream(stamp, std::ios::trunc) << key << "\n";
+    log.ok("Imagem "+format+" em "+out.string()+" ("+human_bytes(fs::file_size(out, ec))+")");
+    return 0;
+}
+
+// === dedup: arquivos idênticos entre as DESTDIRs instaladas viram hardlinks (ou reflinks) ===
+// Parte dos manifests; só arquivos com o mesmo tamanho de outro são lidos e só os de mesmo
+// sha256 (e, para hardlink, mesmo modo/dono) são ligados. A troca é atômica (link/clone num
+// temporário + rename). Os snapshots são .tar.zst, então ficam de fora.
+static int cmd_dedup(const Config&c, bool reflink, bool dryRun, uintmax_t minSize, Logger &log){
+    struct F { fs::path path; struct stat st; };
+    std::map<off_t, std::vector<F>> bySize;
+    std::set<std::pair<dev_t,ino_t>> seenIno;   // um nome por inode: os demais já são o mesmo arquivo
+    size_t scanned = 0;
+    std::error_code ec;
+    for (auto &e: fs::directory_iterator(c.destroot, ec)){
+        if (!e.is_directory(ec)) continue;
+        std::string pkg = e.path().filename().string();
+        std::ifstream in(c.logs/(pkg+".manifest"));
+        if (!in) continue;
+        // manifests antigos (fs::relative) podem ter "../../usr/lib/..." para symlinks absolutos:
+        // só entram caminhos relativos sem "..", cujo diretório resolvido fica dentro do pacote
+        fs::path root = fs::canonical(e.path(), ec);
+        fs::path lastDir; bool lastOk = false;
+        for (std::string rel; std::getline(in, rel); ){
+            if (!untar_safe(rel)) continue;
+            F f{e.path()/rel, {}};
+            if (f.path.parent_path()!=lastDir){
+                lastDir = f.path.parent_path();
+                std::error_code rc;
+                fs::path up = fs::weakly_canonical(lastDir, rc).lexically_relative(root);
+                lastOk = !rc && !up.empty() && *up.begin()!="..";
+            }
+            if (!lastOk) continue;
+            if (lstat(f.path.c_str(), &f.st)!=0 || !S_ISREG(f.st.st_mode) || (uintmax_t)f.st.st_size<std::max<uintmax_t>(minSize, 1)) continue;
+            ++scanned;
+            if (!seenIno.insert({f.st.st_dev, f.st.st_ino}).second) continue;
+            bySize[f.st.st_size].push_back(f);
+        }
+    }
+    std::vector<F> cand;
+    for (auto &kv: bySize) if (kv.second.size()>1) cand.insert(cand.end(), kv.second.begin(), kv.second.end());
+    std::vector<fs::path> paths;
+    for (auto &f: cand) paths.push_back(f.path);
+    auto sums = sha256::files(paths);
+
+    // grupo: conteúdo (+ metadados, no caso de hardlink, que os compartilha)
+    std::map<std::string, std::vector<size_t>> groups;
+    for (size_t i=0;i<cand.size();++i){
+        if (sums[i].empty()) continue;
+        auto &st = cand[i].st;
+        std::string k = sums[i];
+        if (!reflink) k += ":"+std::to_string(st.st_mode)+":"+std::to_string(st.st_uid)+":"+std::to_string(st.st_gid)+":"+std::to_string(st.st_dev);
+        groups[k].push_back(i);
+    }
+    uintmax_t saved = 0; size_t linked = 0, failed = 0;
+    for (auto &g: groups){
+        if (g.second.size()<2) continue;
+        const F &keep = cand[g.second[0]];
+        for (size_t j=1;j<g.second.size();++j){
+            const F &f = cand[g.second[j]];
+            // com hardlink só libera espaço quando era o último nome do inode antigo
+            uintmax_t gain = (reflink || f.st.st_nlink==1) ? f.st.st_size : 0;
+            if (dryRun) { std::cout << f.path.string() << " = " << keep.path.string() << "\n"; saved += gain; ++linked; continue; }
+            fs::path tmp = f.path; tmp += ".cbuild-dedup";
+            fs::remove(tmp, ec);
+            bool ok;
+            if (reflink){
+                int in = open(keep.path.c_str(), O_RDONLY|O_CLOEXEC);
+                int out = in<0 ? -1 : open(tmp.c_str(), O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC, f.st.st_mode & 07777);
+                ok = out>=0 && ioctl(out, FICLONE, in)==0;
+                if (ok){
+                    struct timespec ts[2] = {f.st.st_atim, f.st.st_mtim};
+                    futimens(out, ts);
+                    if (fchown(out, f.st.st_uid, f.st.st_gid)!=0) {}
+                    fchmod(out, f.st.st_mode & 07777);
+                }
+                if (in>=0) close(in);
+                if (out>=0) close(out);
+                if (!ok && (errno==EOPNOTSUPP || errno==EXDEV || errno==EINVAL)){
+                    fs::remove(tmp, ec);
+                    log.err("reflink não suportado aqui ("+std::string(strerror(errno))+"); use dedup sem --reflink");
+                    return 1;
+                }
+            } else { ec.clear(); fs::create_hard_link(keep.path, tmp, ec); ok = !ec; }
+            if (ok) { ec.clear(); fs::rename(tmp, f.path, ec); ok = !ec; }
+            if (!ok) { fs::remove(tmp, ec); ++failed; continue; }
+            saved += gain; ++linked;
+        }
+    }
+    log.ok(std::string(dryRun ? "[dry-run] " : "")+std::to_string(scanned)+" arquivos, "+std::to_string(cand.size())+" lidos, "+
+           std::to_string(linked)+(reflink ? " reflinks" : " hardlinks")+", "+human_bytes(saved)+" economizados"+
+           (failed ? ", "+std::to_string(failed)+" falha(s)" : ""));
+    return failed ? 1 : 0;
+}
+
+// === repositório binário: pacotes .tar.zst + índice mmap para resolver sem receitas ===
+// package grava <dir>/<nome>-<versão>.tar.zst (tar determinístico com .PKGINFO e .SUMS na frente)
+// e atualiza <dir>/index.cbpi. O índice é lido por mmap, sem parse: cabeçalho, registros (um por
+// pacote, com as strings dentro do próprio registro), tabela de offsets ordenada por nome/versão e
+// tabela de provides ordenada. Como os registros não apontam para fora de si, incluir um pacote só
+// desloca bytes e o índice novo casa quase todo com o antigo no repo-pull (blocos no estilo
+// zsync, descritos em index.cbpi.zs e buscados por HTTP Range).
+struct BinPkg {
+    std::string name, version, file, filesDigest, sha;
+    std::vector<std::string> depends, provides;
+    uint64_t size{0}, isize{0};
+};
+
+namespace cbpi {
+struct Head { char magic[4]; uint32_t version, count, nprov; uint64_t recs, offs, provs, total; };
+struct Rec  { uint64_t size, isize; uint8_t files[32], sha[32]; uint16_t nameLen, verLen, fileLen, pad; uint32_t depsLen, provLen; };
+struct Prov { uint32_t entry; uint16_t pos, len; };   // string dentro do bloco provides do registro
+static_assert(sizeof(Head)==48 && sizeof(Rec)==96 && sizeof(Prov)==8, "layout do índice");
+
+static std::string unhex(const std::string &h){
+    std::string o(32, '\0');
+    for (size_t i=0;i<32 && 2*i+1<h.size();++i) o[i] = (char)std::stoi(h.substr(2*i,2), nullptr, 16);
+    return o;
+}
+static std::string tohex(const uint8_t *p, size_t n=32){
+    static const char *dig = "0123456789abcdef";
+    std::string s;
+    for (size_t i=0;i<n;++i) { s += dig[p[i]>>4]; s += dig[p[i]&15]; }
+    return s;
+}
+static std::string join(const std::vector<std::string> &v){
+    std::string o; for (auto &x: v) o += (o.empty()?"":",")+x; return o;
+}
+
+// só leitura; a memória é do mmap, então as views valem enquanto o objeto viver
+struct Index {
+    const uint8_t *base{nullptr}; size_t len{0};
+    const Head *h{nullptr};
+    struct View { const Rec *r; std::string_view name, version, file, deps, prov; };
+    Index() = default;
+    Index(const Index&) = delete;
+    ~Index(){ if (base) munmap((void*)base, len); }
+    bool open(const fs::path &p){
+        int fd = ::open(p.c_str(), O_RDONLY|O_CLOEXEC);
+        if (fd<0) return false;
+        struct stat st{};
+        if (fstat(fd, &st)==0 && st.st_size>=(off_t)sizeof(Head)){
+            void *m = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (m!=MAP_FAILED) { base = (const uint8_t*)m; len = st.st_size; }
+        }
+        close(fd);
+        if (!base) return false;
+        h = (const Head*)base;
+        bool ok = !memcmp(h->magic, "CBPI", 4) && h->version==1 && h->total==len && h->offs<=len && h->provs<=len &&
+                  h->offs+8ull*h->count<=len && h->provs+sizeof(Prov)*(uint64_t)h->nprov<=len;
+        for (uint32_t i=0; ok && i<h->count; ++i){
+            uint64_t o = offs()[i];
+            ok = o<=len && o+sizeof(Rec)<=len;
+            if (ok) { auto *r = (const Rec*)(base+o); ok = o+sizeof(Rec)+r->nameLen+r->verLen+r->fileLen+(uint64_t)r->depsLen+r->provLen<=len; }
+        }
+        // provides apontam para um registro existente e para dentro do bloco provides dele
+        for (uint32_t i=0; ok && i<h->nprov; ++i){
+            const Prov &x = provs()[i];
+            ok = x.entry<h->count && (uint32_t)x.pos+x.len<=((const Rec*)(base+offs()[x.entry]))->provLen;
+        }
+        if (!ok) { munmap((void*)base, len); base = nullptr; h = nullptr; }
+        return ok;
+    }
+    const uint64_t *offs() const { return (const uint64_t*)(base+h->offs); }
+    const Prov *provs() const { return (const Prov*)(base+h->provs); }
+    uint32_t size() const { return h ? h->count : 0; }
+    View at(uint32_t i) const {
+        auto *r = (const Rec*)(base+offs()[i]);
+        const char *s = (const char*)(r+1);
+        View v{r, {s, r->nameLen}, {}, {}, {}, {}};
+        s += r->nameLen; v.version = {s, r->verLen};
+        s += r->verLen;  v.file = {s, r->fileLen};
+        s += r->fileLen; v.deps = {s, r->depsLen};
+        s += r->depsLen; v.prov = {s, r->provLen};
+        return v;
+    }
+    // [lo,hi) com todas as versões do nome, em ordem crescente de versão
+    std::pair<uint32_t,uint32_t> range(std::string_view name) const {
+        uint32_t lo = 0, hi = size();
+        while (lo<hi) { uint32_t m = (lo+hi)/2; if (at(m).name<name) lo = m+1; else hi = m; }
+        uint32_t e = lo;
+        while (e<size() && at(e).name==name) ++e;
+        return {lo, e};
+    }
+    // pacote que fornece p (o de maior versão, que vem por último entre iguais), ou -1
+    long provider(std::string_view p) const {
+        auto str = [&](const Prov &x){ return at(x.entry).prov.substr(x.pos, x.len); };
+        uint32_t lo = 0, hi = h ? h->nprov : 0;
+        while (lo<hi) { uint32_t m = (lo+hi)/2; if (str(provs()[m])<=p) lo = m+1; else hi = m; }
+        return lo>0 && str(provs()[lo-1])==p ? (long)provs()[lo-1].entry : -1;
+    }
+    BinPkg pkg(uint32_t i) const {
+        View v = at(i);
+        BinPkg b{std::string(v.name), std::string(v.version), std::string(v.file), tohex(v.r->files), tohex(v.r->sha),
+                 Recipe::split_list(std::string(v.deps)), Recipe::split_list(std::string(v.prov)), v.r->size, v.r->isize};
+        return b;
+    }
+};
+
+// soma fraca no estilo rsync (a | b<<16), rolável byte a byte
+struct Weak {
+    uint32_t a{0}, b{0}; size_t L{0};
+    void init(const uint8_t *p, size_t n){ a = b = 0; L = n; for (size_t i=0;i<n;++i) { a += p[i]; b += (uint32_t)(n-i)*p[i]; } }
+    void roll(uint8_t out, uint8_t in){ a += in - out; b += a - (uint32_t)L*out; }
+    uint32_t get() const { return (a & 0xffff) | (b << 16); }
+};
+static std::string strong(const uint8_t *p, size_t n){
+    sha256::Ctx x; x.update(p, n); return x.final().substr(0, 16);
+}
+
+// assinatura por blocos: "cbzs 1 <bloco> <tamanho> <sha256>" e uma linha "<fraca> <forte>" por bloco
+// (o último é completado com zeros)
+static std::string signature(const std::string &data, size_t block){
+    std::ostringstream o;
+    o << "cbzs 1 " << block << " " << data.size() << " " << sha256::str(data) << "\n";
+    std::vector<uint8_t> buf(block);
+    for (size_t off=0; off<data.size(); off+=block){
+        size_t n = std::min(block, data.size()-off);
+        std::fill(buf.begin(), buf.end(), 0);
+        memcpy(buf.data(), data.data()+off, n);
+        Weak w; w.init(buf.data(), block);
+        char wh[9]; snprintf(wh, sizeof wh, "%08x", w.get());
+        o << wh << " " << strong(buf.data(), block) << "\n";
+    }
+    return o.str();
+}
+
+// grava file e file.zs, cada um trocado por rename
+static bool write_signed(const fs::path &file, const std::string &data, size_t block){
+    fs::path tmp = file; tmp += ".tmp";
+    fs::path sig = file; sig += ".zs";
+    fs::path sigTmp = sig; sigTmp += ".tmp";
+    std::ofstream(tmp, std::ios::binary|std::ios::trunc) << data;
+    std::ofstream(sigTmp, std::ios::binary|std::ios::trunc) << signature(data, block);
+    std::error_code ec;
+    fs::rename(sigTmp, sig, ec);
+    if (!ec) fs::rename(tmp, file, ec);
+    return !ec;
+}
+
+static bool write_index(const fs::path &file, std::vector<BinPkg> pkgs, size_t block){
+    std::sort(pkgs.begin(), pkgs.end(), [](const BinPkg &a, const BinPkg &b){
+        return a.name!=b.name ? a.name<b.name : version_cmp(a.version, b.version)<0; });
+    std::string recs;
+    std::vector<uint64_t> offs;
+    struct P { std::string s; uint32_t entry; uint16_t pos; };
+    std::vector<P> provs;
+    for (uint32_t i=0;i<pkgs.size();++i){
+        auto &p = pkgs[i];
+        std::string deps = join(p.depends), prov = join(p.provides);
+        if (p.name.size()>0xffff || p.version.size()>0xffff || p.file.size()>0xffff || prov.size()>0xffff) return false;
+        Rec r{};
+        r.size = p.size; r.isize = p.isize;
+        memcpy(r.files, unhex(p.filesDigest).data(), 32);
+        memcpy(r.sha, unhex(p.sha).data(), 32);
+        r.nameLen = p.name.size(); r.verLen = p.version.size(); r.fileLen = p.file.size();
+        r.depsLen = deps.size(); r.provLen = prov.size();
+        offs.push_back(sizeof(Head)+recs.size());
+        recs.append((const char*)&r, sizeof r);
+        recs += p.name+p.version+p.file+deps+prov;
+        recs.resize((recs.size()+7)&~(size_t)7, '\0');
+        size_t pos = 0;
+        for (auto &x: p.provides) { pos = prov.find(x, pos); provs.push_back({x, i, (uint16_t)pos}); pos += x.size(); }
+    }
+    std::stable_sort(provs.begin(), provs.end(), [](const P &a, const P &b){ return a.s<b.s; });
+    Head h{{'C','B','P','I'}, 1, (uint32_t)pkgs.size(), (uint32_t)provs.size(), sizeof(Head), 0, 0, 0};
+    h.offs = h.recs+recs.size();
+    h.provs = h.offs+8*offs.size();
+    h.total = h.provs+sizeof(Prov)*provs.size();
+    std::string out((const char*)&h, sizeof h);
+    out += recs;
+    out.append((const char*)offs.data(), 8*offs.size());
+    for (auto &p: provs) { Prov x{p.entry, p.pos, (uint16_t)p.s.size()}; out.append((const char*)&x, sizeof x); }
+
+    return write_signed(file, out, block);
+}
+} // namespace cbpi
+
+// entradas (caminhos) de um .sums
+static std::vector<std::string> sums_paths(const std::string &sums){
+    std::vector<std::string> v;
+    std::istringstream in(sums);
+    for (std::string line; std::getline(in, line); ) if (!line.empty()) v.push_back(line.substr(0, line.find('\t')));
+    return v;
+}
+
+// trava do repositório binário (<dir>/.lock): package e repo-index leem, alteram e regravam
+// index.cbpi e files.cbfi, e duas execuções simultâneas perderiam entradas
+struct RepoLock {
+    int fd{-1};
+    explicit RepoLock(const fs::path &dir){
+        fd = open((dir/".lock").c_str(), O_CREAT|O_RDWR|O_CLOEXEC, 0644);
+        if (fd>=0) flock(fd, LOCK_EX);
+    }
+    RepoLock(const RepoLock&) = delete;
+    ~RepoLock(){ if (fd>=0) { flock(fd, LOCK_UN); close(fd); } }
+};
+
+// reescreve files.cbfi: entradas atuais cujo dono passa em keepOld + add (dono -> caminhos), num
+// merge-join com o índice antigo lido direto do mmap; o chamador segura o RepoLock
+static bool update_files_index(const fs::path &file, const std::function<bool(const std::string&)> &keepOld,
+                               const std::map<std::string, std::vector<std::string>> &add, size_t block){
+    cbfi::Index old;
+    bool haveOld = old.open(file);
+    std::set<std::string> names;
+    for (uint32_t i=0; haveOld && i<old.h->nowners; ++i){
+        std::string o(old.owner(i));
+        if (keepOld(o) && !add.count(o)) names.insert(o);
+    }
+    for (auto &a: add) names.insert(a.first);
+    std::vector<std::string> owners(names.begin(), names.end());
+    auto id = [&](const std::string &o){ return (uint64_t)(std::lower_bound(owners.begin(), owners.end(), o)-owners.begin()); };
+    std::vector<long> remap;
+    for (uint32_t i=0; haveOld && i<old.h->nowners; ++i){
+        std::string o(old.owner(i));
+        remap.push_back(keepOld(o) && !add.count(o) ? (long)id(o) : -1);
+    }
+    std::vector<std::pair<std::string, uint64_t>> fresh;
+    for (auto &a: add) for (auto &p: a.second) fresh.push_back({p, id(a.first)});
+    std::sort(fresh.begin(), fresh.end());
+
+    cbfi::Writer paths, bases;
+    std::vector<std::pair<std::string, uint64_t>> bn;
+    auto emit = [&](std::string_view k, uint64_t o){
+        auto slash = k.rfind('/');
+        bn.push_back({std::string(slash==std::string_view::npos ? k : k.substr(slash+1)), paths.count});
+        paths.add(k, o);
+    };
+    size_t j = 0;
+    if (haveOld) old.walk(old.h->paths, 0, [&](uint64_t, std::string_view key, uint64_t v){
+        if (v>=remap.size() || remap[v]<0) return true;
+        while (j<fresh.size() && std::make_pair(std::string_view(fresh[j].first), fresh[j].second) < std::make_pair(key, (uint64_t)remap[v])) { emit(fresh[j].first, fresh[j].second); ++j; }
+        emit(key, remap[v]);
+        return true;
+    });
+    for (; j<fresh.size(); ++j) emit(fresh[j].first, fresh[j].second);
+    std::sort(bn.begin(), bn.end());
+    for (auto &b: bn) bases.add(b.first, b.second);
+    return cbpi::write_signed(file, cbfi::build(owners, paths, bases), block);
+}
+
+// lê .PKGINFO/.SUMS (os primeiros membros do pacote) sem extrair o resto
+static bool read_member(const fs::path &pkg, const std::string &member, std::string &out){
+    return read_cmd("zstd -dcq '"+pkg.string()+"' | tar --occurrence=1 -xOf - ./"+member+" 2>/dev/null", out)==0 && !out.empty();
+}
+
+static bool read_pkginfo(const fs::path &pkg, BinPkg &b){
+    std::string out;
+    if (!read_member(pkg, ".PKGINFO", out)) return false;
+    std::istringstream in(out);
+    for (std::string line; std::getline(in, line); ){
+        auto eq = line.find(" = ");
+        if (eq==std::string::npos) continue;
+        std::string k = line.substr(0, eq), v = line.substr(eq+3);
+        if (k=="pkgname") b.name = v;
+        else if (k=="pkgver") b.version = v;
+        else if (k=="depend") b.depends.push_back(v);
+        else if (k=="provides") b.provides.push_back(v);
+        else if (k=="isize") b.isize = std::stoull(v);
+        else if (k=="filesdigest") b.filesDigest = v;
+    }
+    std::error_code ec;
+    b.file = pkg.filename().string();
+    b.size = fs::file_size(pkg, ec);
+    b.sha = sha256::file(pkg);
+    return !b.name.empty() && !b.version.empty();
+}
+
+static std::vector<BinPkg> load_index(const fs::path &file){
+    std::vector<BinPkg> v;
+    cbpi::Index idx;
+    if (idx.open(file)) for (uint32_t i=0;i<idx.size();++i) v.push_back(idx.pkg(i));
+    return v;
+}
+
+static int cmd_package(const Config&c, const Recipe&r, Logger &log){
+    if (!installed_sums(c, r, log)) return 1;
+    fs::path dir = c.binrepo, sums = sums_file(c,r), dest = destdir_pkg(c,r);
+    fs::create_directories(dir);
+    BinPkg b;
+    b.name = r.name; b.version = r.version;
+    b.file = r.name+"-"+r.version+".tar.zst";
+    b.depends = Recipe::split_list(r.depends);
+    b.filesDigest = sha256::file(sums);
+    // provides: sonames das bibliotecas (libz.so.1 -> so:libz.so.1)
+    static const std::regex soRe(R"(^lib[^/]*\.so(\.[0-9.]+)?$)");
+    std::ifstream in(sums);
+    for (std::string line; std::getline(in, line); ){
+        std::istringstream ls(line); std::string rel, mode, size;
+        std::getline(ls, rel, '\t'); std::getline(ls, mode, '\t'); std::getline(ls, size, '\t');
+        mode_t m = std::stoul(mode, nullptr, 8);
+        if (S_ISREG(m)) b.isize += std::stoull(size);
+        std::string base = fs::path(rel).filename().string();
+        if ((S_ISREG(m) || S_ISLNK(m)) && rel.find("lib")!=std::string::npos && std::regex_match(base, soRe)) b.provides.push_back("so:"+base);
+    }
+    std::sort(b.provides.begin(), b.provides.end());
+    b.provides.erase(std::unique(b.provides.begin(), b.provides.end()), b.provides.end());
+
+    fs::path tmp = dir/(".pkg-"+std::to_string(getpid()));
+    std::error_code ec;
+    fs::remove_all(tmp, ec);
+    fs::create_directories(tmp);
+    {
+        std::ofstream pi(tmp/".PKGINFO");
+        pi << "pkgname = " << b.name << "\npkgver = " << b.version << "\n";
+        for (auto &d: b.depends) pi << "depend = " << d << "\n";
+        for (auto &p: b.provides) pi << "provides = " << p << "\n";
+        pi << "isize = " << b.isize << "\nfilesdigest = " << b.filesDigest << "\n";
+    }
+    fs::copy_file(sums, tmp/".SUMS", ec);
+    sums_tar_list(sums, tmp/"list");
+    fs::path out = dir/b.file, part = tmp/"pkg.tar.zst";
+    int rc = exec_cmd("bash -c \"set -o pipefail; "+std::string(det_tar)+" -C '"+tmp.string()+"' ./.PKGINFO ./.SUMS -C '"+dest.string()+
+                      "' -T '"+(tmp/"list").string()+"' | zstd -T0 -q -c > '"+part.string()+"'\"", log, false);
+    if (!rc) { fs::rename(part, out, ec); if (ec) rc = 1; }
+    fs::remove_all(tmp, ec);
+    if (rc) { log.err("falha ao gerar pacote "+b.file); return rc ? rc : 1; }
+    b.size = fs::file_size(out, ec);
+    b.sha = sha256::file(out);
+
+    // atualização incremental do índice: troca só a entrada deste nome+versão
+    RepoLock lock(dir);
+    std::vector<BinPkg> pkgs = load_index(dir/"index.cbpi");
+    pkgs.erase(std::remove_if(pkgs.begin(), pkgs.end(), [&](const BinPkg &p){ return p.name==b.name && p.version==b.version; }), pkgs.end());
+    pkgs.push_back(b);
+    std::string owner = b.name+"-"+b.version, sumsText;
+    { std::ifstream in(sums); std::stringstream ss; ss << in.rdbuf(); sumsText = ss.str(); }
+    if (!cbpi::write_index(dir/"index.cbpi", pkgs, c.binrepo_block) ||
+        !update_files_index(dir/"files.cbfi", [&](const std::string &o){ return o!=owner; }, {{owner, sums_paths(sumsText)}}, c.binrepo_block)){
+        log.err("falha ao gravar índice em "+dir.string()); return 1;
+    }
+    log.ok("Pacote "+b.file+" ("+human_bytes(b.size)+", "+std::to_string(b.provides.size())+" provides) em "+dir.string());
+    return 0;
+}
+
+// reconstrói o índice a partir dos .tar.zst do diretório (reaproveita as entradas com o mesmo sha256)
+static int cmd_repo_index(const Config&c, const fs::path &dir, Logger &log){
+    RepoLock lock(dir);
+    std::map<std::string, BinPkg> old;
+    for (auto &p: load_index(dir/"index.cbpi")) old[p.file] = p;
+    std::vector<fs::path> files;
+    std::error_code ec;
+    for (auto &e: fs::directory_iterator(dir, ec)){
+        std::string n = e.path().filename().string();
+        if (e.is_regular_file(ec) && n.size()>8 && n.compare(n.size()-8, 8, ".tar.zst")==0) files.push_back(e.path());
+    }
+    if (ec) { log.err("não foi possível ler "+dir.string()+": "+ec.message()); return 1; }
+    auto sums = sha256::files(files);
+    std::vector<BinPkg> pkgs;
+    std::set<std::string> kept;                                // donos cujos caminhos seguem no files.cbfi
+    std::map<std::string, std::vector<std::string>> added;
+    bool haveFiles = fs::exists(dir/"files.cbfi");
+    size_t reused = 0, bad = 0;
+    for (size_t i=0;i<files.size();++i){
+        auto it = old.find(files[i].filename().string());
+        BinPkg b;
+        bool same = it!=old.end() && it->second.sha==sums[i];
+        if (same) { b = it->second; ++reused; }
+        else if (!read_pkginfo(files[i], b)) { log.warn("sem .PKGINFO válido: "+files[i].string()); ++bad; continue; }
+        pkgs.push_back(b);
+        std::string owner = b.name+"-"+b.version, text;
+        if (same && haveFiles) kept.insert(owner);
+        else if (read_member(files[i], ".SUMS", text)) added[owner] = sums_paths(text);
+    }
+    if (!cbpi::write_index(dir/"index.cbpi", pkgs, c.binrepo_block) ||
+        !update_files_index(dir/"files.cbfi", [&](const std::string &o){ return kept.count(o)>0; }, added, c.binrepo_block)){
+        log.err("falha ao gravar índice em "+dir.string()); return 1;
+    }
+    log.ok("Índice de "+dir.string()+": "+std::to_string(pkgs.size())+" pacote(s), "+std::to_string(reused)+" reaproveitado(s)"+
+           (bad ? ", "+std::to_string(bad)+" inválido(s)" : ""));
+    return bad ? 1 : 0;
+}
+
+// baixa <base><name> para dir/<name>: lê <name>.zs, reaproveita os blocos da cópia local (soma
+// fraca rolante + forte) e busca só os que faltam por Range, todos num único curl (--next)
+static int pull_signed(const fs::path &dir, const std::string &base, const std::string &name, Logger &log){
+    fs::path local = dir/name, tmp = dir/("pull-"+std::to_string(getpid()));
+    std::error_code ec;
+    fs::create_directories(tmp);
+    auto cleanup = [&]{ fs::remove_all(tmp, ec); };
+    std::string sig, url = base+name;
+    if (read_cmd("curl -fsSL '"+url+".zs'", sig)!=0) { cleanup(); log.err("não foi possível baixar "+url+".zs"); return 1; }
+    std::istringstream ss(sig);
+    std::string magic, ver, want; size_t block = 0; uint64_t total = 0;
+    ss >> magic >> ver >> block >> total >> want;
+    if (magic!="cbzs" || ver!="1" || block==0) { cleanup(); log.err("assinatura inválida em "+url+".zs"); return 1; }
+    std::vector<std::pair<uint32_t,std::string>> blocks;
+    for (std::string w, s; ss >> w >> s; ) blocks.push_back({(uint32_t)std::stoul(w, nullptr, 16), s});
+    if (blocks.size()!=(total+block-1)/block) { cleanup(); log.err("assinatura truncada: "+url+".zs"); return 1; }
+    if (fs::exists(local) && sha256::file(local)==want) { cleanup(); log.ok(name+" já atualizado ("+human_bytes(total)+")"); return 0; }
+
+    std::string out(blocks.size()*block, '\0');
+    std::vector<bool> have(blocks.size(), false);
+    std::string old;
+    { std::ifstream in(local, std::ios::binary); std::stringstream b; b << in.rdbuf(); old = b.str(); }
+    size_t found = 0;
+    if (old.size()>=block){
+        std::unordered_map<uint32_t, std::vector<size_t>> byWeak;
+        for (size_t i=0;i<blocks.size();++i) byWeak[blocks[i].first].push_back(i);
+        const uint8_t *p = (const uint8_t*)old.data();
+        cbpi::Weak w; w.init(p, block);
+        for (size_t off=0; off+block<=old.size(); ){
+            bool hit = false;
+            auto it = byWeak.find(w.get());
+            if (it!=byWeak.end()){
+                std::string st;
+                for (size_t j: it->second){
+                    if (have[j]) continue;
+                    if (st.empty()) st = cbpi::strong(p+off, block);
+                    if (st!=blocks[j].second) continue;
+                    memcpy(&out[j*block], p+off, block); have[j] = true; ++found; hit = true;
+                }
+            }
+            if (hit && off+2*block<=old.size()) { off += block; w.init(p+off, block); continue; }
+            if (off+block>=old.size()) break;
+            w.roll(p[off], p[off+block]); ++off;
+        }
+    }
+    // blocos faltantes viram faixas contíguas
+    std::vector<std::pair<uint64_t,uint64_t>> runs;
+    for (size_t i=0;i<blocks.size();++i){
+        if (have[i]) continue;
+        uint64_t a = i*block, b = std::min<uint64_t>(total, (i+1)*block)-1;
+        if (!runs.empty() && runs.back().second+1==a) runs.back().second = b; else runs.push_back({a, b});
+    }
+    uint64_t fetched = 0;
+    bool full = false;
+    for (size_t g=0; g<runs.size() && !full; g+=64){
+        std::string cmd = "curl -sSL";
+        for (size_t k=g; k<std::min(runs.size(), g+64); ++k)
+            cmd += std::string(k>g ? " --next -sSL" : "")+" -f -r "+std::to_string(runs[k].first)+"-"+std::to_string(runs[k].second)+
+                   " -o '"+(tmp/std::to_string(k)).string()+"' '"+url+"'";
+        if (exec_cmd(cmd, log, false)) { full = true; break; }
+        for (size_t k=g; k<std::min(runs.size(), g+64); ++k){
+            std::ifstream in(tmp/std::to_string(k), std::ios::binary);
+            std::string part((std::istreambuf_iterator<char>(in)), {});
+            // servidor sem Range devolve o arquivo inteiro
+            if (part.size()!=runs[k].second-runs[k].first+1) { full = true; break; }
+            memcpy(&out[runs[k].first], part.data(), part.size());
+            fetched += part.size();
+        }
+    }
+    out.resize(total);
+    if (full || sha256::str(out)!=want){
+        log.warn("download por blocos falhou; baixando "+name+" inteiro");
+        if (exec_cmd("curl -fsSL -o '"+(tmp/"full").string()+"' '"+url+"'", log, false)) { cleanup(); log.err("falha ao baixar "+url); return 1; }
+        std::ifstream in(tmp/"full", std::ios::binary);
+        out.assign((std::istreambuf_iterator<char>(in)), {});
+        fetched = out.size(); found = 0;
+        if (sha256::str(out)!=want) { cleanup(); log.err("sha256 de "+name+" não confere"); return 1; }
+    }
+    std::ofstream(tmp/"data", std::ios::binary) << out;
+    fs::rename(tmp/"data", local, ec);
+    cleanup();
+    log.ok(name+": "+human_bytes(total)+"; baixados "+human_bytes(fetched)+
+           " ("+std::to_string(found)+"/"+std::to_string(blocks.size())+" blocos reaproveitados)");
+    return 0;
+}
+
+// repo-pull: índice de pacotes (obrigatório) e índice de arquivos (se o repositório tiver)
+static int cmd_repo_pull(const Config&c, const std::string &url, Logger &log){
+    if (url.empty()) { log.err("sem url do repositório ([binrepo] url= ou --url)"); return 1; }
+    fs::path dir = c.base/"binrepo";
+    std::string base = url.back()=='/' ? url : url+"/";
+    if (int rc = pull_signed(dir, base, "index.cbpi", log)) return rc;
+    cbpi::Index idx;
+    if (!idx.open(dir/"index.cbpi")) { log.err("índice baixado é inválido"); return 1; }
+    std::ofstream(dir/"url") << base << "\n";
+    if (pull_signed(dir, base, "files.cbfi", log)) log.warn("sem índice de arquivos em "+base+" (provides usará o local)");
+    log.ok("Repositório "+base+": "+std::to_string(idx.size())+" pacote(s)");
+    return 0;
+}
+
+// índice de pacotes a usar: o baixado pelo repo-pull ou o do repositório local
+static fs::path pkg_index_path(const Config&c){
+    fs::path pulled = c.base/"binrepo"/"index.cbpi";
+    return fs::exists(pulled) ? pulled : c.binrepo/"index.cbpi";
+}
+
+// fecho de dependências em ordem de instalação (dependências antes); nomes aceitam nome,
+// nome=versão e so:soname
+static std::vector<uint32_t> resolve_order(const cbpi::Index &idx, const std::vector<std::string> &names,
+                                           std::vector<std::string> &missing, Logger &log){
+    auto find = [&](const std::string &want)->long{
+        auto eq = want.find('=');
+        std::string n = want.substr(0, eq);
+        auto rg = idx.range(n);
+        if (eq!=std::string::npos){
+            for (uint32_t i=rg.first;i<rg.second;++i) if (idx.at(i).version==want.substr(eq+1)) return i;
+            return -1;
+        }
+        return rg.first<rg.second ? (long)rg.second-1 : idx.provider(n);
+    };
+    std::vector<uint32_t> order;
+    std::vector<uint8_t> state(idx.size(), 0);   // 0 novo, 1 em curso, 2 feito
+    std::function<void(uint32_t)> visit = [&](uint32_t i){
+        if (state[i]) { if (state[i]==1) log.warn("ciclo de dependências em "+std::string(idx.at(i).name)); return; }
+        state[i] = 1;
+        for (auto &d: Recipe::split_list(std::string(idx.at(i).deps))){
+            long j = find(d);
+            if (j<0) missing.push_back(d+" (de "+std::string(idx.at(i).name)+")"); else visit(j);
+        }
+        state[i] = 2;
+        order.push_back(i);
+    };
+    for (auto &n: names){
+        long i = find(n);
+        if (i<0) missing.push_back(n); else visit(i);
+    }
+    return order;
+}
+
+// resolve: mostra o fecho de dependências a partir do índice, sem receitas
+static int cmd_resolve(const Config&c, const std::vector<std::string> &names, const fs::path &indexFile, bool json, Logger &log){
+    auto t0 = std::chrono::steady_clock::now();
+    fs::path file = indexFile.empty() ? pkg_index_path(c) : indexFile;
+    cbpi::Index idx;
+    if (!idx.open(file)) { log.err("índice ausente ou inválido: "+file.string()+" (rode repo-pull ou repo-index)"); return 1; }
+    std::vector<std::string> missing;
+    std::vector<uint32_t> order = resolve_order(idx, names, missing, log);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-t0).count();
+    uint64_t dl = 0, inst = 0;
+    for (auto i: order) { dl += idx.at(i).r->size; inst += idx.at(i).r->isize; }
+    if (json){
+        std::cout << "{\"packages\":[";
+        for (size_t k=0;k<order.size();++k){
+            auto v = idx.at(order[k]);
+            std::cout << (k?",":"") << "{\"name\":" << json_str(std::string(v.name)) << ",\"version\":" << json_str(std::string(v.version))
+                      << ",\"file\":" << json_str(std::string(v.file)) << ",\"size\":" << v.r->size << ",\"isize\":" << v.r->isize
+                      << ",\"sha256\":\"" << cbpi::tohex(v.r->sha) << "\"}";
+        }
+        std::cout << "],\"missing\":[";
+        for (size_t k=0;k<missing.size();++k) std::cout << (k?",":"") << json_str(missing[k]);
+        std::cout << "],\"ms\":" << ms << "}\n";
+    } else {
+        for (auto i: order){
+            auto v = idx.at(i);
+            std::cout << std::left << std::setw(24) << v.name << " " << std::setw(14) << v.version << " "
+                      << std::right << std::setw(10) << human_bytes(v.r->size) << "  " << v.file << "\n";
+        }
+        for (auto &m: missing) std::cout << ansi::red << "não encontrado: " << m << ansi::reset << "\n";
+        std::cout << order.size() << " pacote(s), " << human_bytes(dl) << " a baixar, " << human_bytes(inst) << " instalados; "
+                  << std::fixed << std::setprecision(2) << ms << " ms (" << idx.size() << " no índice)\n";
+    }
+    return missing.empty() ? 0 : 1;
+}
+
+// provides: quem fornece um caminho, basename ou glob, pelo files.cbfi (sem nada instalado)
+static int cmd_provides(const Config&c, const std::vector<std::string> &queries, const fs::path &indexFile, Logger &log){
+    auto t0 = std::chrono::steady_clock::now();
+    fs::path file = indexFile.empty() ? files_index_path(c) : indexFile;
+    cbfi::Index idx;
+    if (!idx.open(file)) { log.err("índice de arquivos ausente ou inválido: "+file.string()+" (rode package, repo-index ou repo-pull)"); return 1; }
+    size_t hits = 0;
+    for (auto &q: queries){
+        size_t before = hits;
+        idx.query(q, [&](std::string_view path, std::string_view owner){
+            std::cout << std::left << std::setw(28) << owner << " /" << path << "\n";
+            ++hits;
+        });
+        if (hits==before) std::cout << ansi::red << "nenhum pacote fornece " << q << ansi::reset << "\n";
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-t0).count();
+    std::cout << ansi::dim << hits << " resultado(s) em " << idx.h->paths.count << " caminhos; " << std::fixed << std::setprecision(2) << ms << " ms" << ansi::reset << "\n";
+    return hits ? 0 : 1;
+}
+
+// === pacotes delta: de <nome>-<antiga> para <nome>-<nova> ===
+// O .delta é um tar.zst com .DELTA (uma linha por entrada do .SUMS novo), .PKGINFO e .SUMS novos,
+// files/<caminho> para arquivos sem base aproveitável e patches/<n>.zst (zstd --patch-from com o
+// arquivo antigo como dicionário). Arquivos iguais a algum antigo viram referência (same/copy).
+// O cliente confere o .SUMS novo contra o filesDigest do índice, o sha256 de cada arquivo antigo
+// usado antes e a árvore inteira contra esse .SUMS depois, e só então cria a DESTDIR nova.
+struct SumEntry { mode_t mode{0}; uintmax_t size{0}; std::string sha; };
+
+static std::map<std::string, SumEntry> parse_sums(const std::string &text){
+    std::map<std::string, SumEntry> m;
+    std::istringstream in(text);
+    for (std::string line; std::getline(in, line); ){
+        std::istringstream ls(line); std::string rel, mode, size, sum;
+        if (!std::getline(ls, rel, '\t') || !std::getline(ls, mode, '\t') || !std::getline(ls, size, '\t') || !std::getline(ls, sum, '\t')) continue;
+        m[rel] = {(mode_t)std::stoul(mode, nullptr, 8), std::stoull(size), sum};
+    }
+    return m;
+}
+
+// "libfoo.so.1.2.3" e "libfoo.so.1.2.4" têm a mesma forma: números viram "#"
+static std::string version_shape(const std::string &rel){
+    std::string o;
+    for (char ch: rel) if (!isdigit((unsigned char)ch)) o += ch; else if (o.empty() || o.back()!='#') o += '#';
+    return o;
+}
+
+static int cmd_delta(const Config&c, const std::string &name, const std::string &from, std::string to, Logger &log){
+    fs::path dir = c.binrepo;
+    if (to.empty()){
+        cbpi::Index idx;
+        if (idx.open(dir/"index.cbpi")) { auto rg = idx.range(name); if (rg.first<rg.second) to = std::string(idx.at(rg.second-1).version); }
+        if (to.empty()) { log.err(name+": sem pacotes no índice de "+dir.string()); return 1; }
+    }
+    if (from==to) { log.err("versões iguais: "+from); return 1; }
+    fs::path oldPkg = dir/(name+"-"+from+".tar.zst"), newPkg = dir/(name+"-"+to+".tar.zst");
+    for (auto &p: {oldPkg, newPkg}) if (!fs::exists(p)) { log.err("pacote ausente: "+p.string()); return 1; }
+    fs::path tmp = c.work/(".delta-"+std::to_string(getpid())), oldDir = tmp/"old", newDir = tmp/"new", stage = tmp/"stage";
+    std::error_code ec;
+    fs::remove_all(tmp, ec);
+    for (auto &d: {oldDir, newDir, stage/"files", stage/"patches"}) fs::create_directories(d);
+    auto cleanup = [&]{ discard_tree(c, tmp); };
+    for (auto &pr: {std::make_pair(oldPkg, oldDir), std::make_pair(newPkg, newDir)})
+        if (exec_cmd("bash -c \"set -o pipefail; zstd -dcq '"+pr.first.string()+"' | tar -xf - -C '"+pr.second.string()+"'\"", log, false)){
+            cleanup(); log.err("falha ao extrair "+pr.first.string()); return 1;
+        }
+    auto slurp = [](const fs::path &p){ std::ifstream in(p, std::ios::binary); std::stringstream ss; ss << in.rdbuf(); return ss.str(); };
+    std::string oldSumsText = slurp(oldDir/".SUMS"), newSumsText = slurp(newDir/".SUMS");
+    auto oldSums = parse_sums(oldSumsText), newSums = parse_sums(newSumsText);
+    std::map<std::string, std::string> bySha, byShape;   // sha256 / forma -> caminho antigo (só arquivos regulares)
+    for (auto &e: oldSums) if (S_ISREG(e.second.mode)) { bySha.emplace(e.second.sha, e.first); byShape.emplace(version_shape(e.first), e.first); }
+
+    struct Job { std::string rel, base; size_t n; bool patch{false}; };
+    std::vector<std::string> lines;
+    std::vector<Job> jobs;
+    size_t same = 0, copies = 0;
+    for (auto &e: newSums){
+        const std::string &rel = e.first;
+        const SumEntry &s = e.second;
+        if (S_ISLNK(s.mode)) { lines.push_back("link\t"+rel+"\t"+fs::read_symlink(newDir/rel, ec).string()); continue; }
+        auto o = oldSums.find(rel);
+        if (o!=oldSums.end() && S_ISREG(o->second.mode) && o->second.sha==s.sha) { lines.push_back("same\t"+rel+"\t"+s.sha); ++same; continue; }
+        auto bs = bySha.find(s.sha);
+        if (bs!=bySha.end()) { lines.push_back("copy\t"+rel+"\t"+bs->second+"\t"+s.sha); ++copies; continue; }
+        std::string base = o!=oldSums.end() && S_ISREG(o->second.mode) ? rel : "";
+        if (base.empty()) { auto sh = byShape.find(version_shape(rel)); if (sh!=byShape.end()) base = sh->second; }
+        jobs.push_back({rel, base, jobs.size()});
+        lines.push_back("");   // preenchida depois do patch
+    }
+    // patches em paralelo; fica o menor entre patch e arquivo inteiro comprimido
+    std::atomic<size_t> next{0};
+    std::atomic<bool> failed{false};
+    auto worker = [&]{
+        for (size_t i; (i=next++)<jobs.size(); ){
+            Job &j = jobs[i];
+            if (j.base.empty() || newSums.at(j.rel).size<4096) continue;
+            fs::path patch = stage/"patches"/(std::to_string(j.n)+".zst"), full = stage/"patches"/(std::to_string(j.n)+".full");
+            std::string nf = (newDir/j.rel).string();
+            if (exec_cmd("zstd -q -19 --patch-from='"+(oldDir/j.base).string()+"' '"+nf+"' -o '"+patch.string()+"'", log, false) ||
+                exec_cmd("zstd -q -19 '"+nf+"' -o '"+full.string()+"'", log, false)) { failed = true; continue; }
+            j.patch = fs::file_size(patch, ec) < fs::file_size(full, ec);
+            fs::remove(full, ec);
+            if (!j.patch) fs::remove(patch, ec);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned t=0; t<std::max(1u, std::thread::hardware_concurrency()); ++t) pool.emplace_back(worker);
+    for (auto &t: pool) t.join();
+    if (failed) { cleanup(); log.err("zstd --patch-from falhou"); return 1; }
+    size_t patched = 0, full = 0, k = 0;
+    for (auto &l: lines){
+        if (!l.empty()) continue;
+        Job &j = jobs[k++];
+        if (j.patch) { l = "patch\t"+j.rel+"\t"+j.base+"\t"+oldSums.at(j.base).sha+"\tpatches/"+std::to_string(j.n)+".zst"; ++patched; continue; }
+        fs::create_directories((stage/"files"/j.rel).parent_path(), ec);
+        fs::rename(newDir/j.rel, stage/"files"/j.rel, ec);
+        l = "file\t"+j.rel;
+        ++full;
+    }
+    {
+        std::ofstream d(stage/".DELTA", std::ios::binary);
+        d << "cbdelta 1\nfrom\t" << name << "\t" << from << "\nto\t" << name << "\t" << to << "\n";
+        for (auto &l: lines) d << l << "\n";
+    }
+    fs::copy_file(newDir/".PKGINFO", stage/".PKGINFO", ec);
+    fs::copy_file(newDir/".SUMS", stage/".SUMS", ec);
+    std::set<std::string> names;
+    for (auto &e: fs::recursive_directory_iterator(stage)) names.insert(fs::relative(e.path(), stage).string());
+    {
+        std::ofstream lo(tmp/"list", std::ios::binary);
+        for (auto &n: {".DELTA", ".PKGINFO", ".SUMS"}) lo << "./" << n << '\0';
+        for (auto &n: names) if (n[0]!='.') lo << "./" << n << '\0';
+    }
+    fs::path out = dir/(name+"-"+from+"_"+to+".delta"), part = tmp/"delta";
+    int rc = exec_cmd("bash -c \"set -o pipefail; "+std::string(det_tar)+" -C '"+stage.string()+"' -T '"+(tmp/"list").string()+
+                      "' | zstd -T0 -q -19 -c > '"+part.string()+"'\"", log, false);
+    if (!rc) { fs::rename(part, out, ec); if (ec) rc = 1; }
+    cleanup();
+    if (rc) { log.err("falha ao gravar "+out.string()); return rc; }
+    uintmax_t dsz = fs::file_size(out, ec), psz = fs::file_size(newPkg, ec);
+    log.ok("Delta "+out.filename().string()+": "+human_bytes(dsz)+" (pacote inteiro "+human_bytes(psz)+"); "+
+           std::to_string(same)+" iguais, "+std::to_string(copies)+" movidos, "+std::to_string(patched)+" patches, "+std::to_string(full)+" inteiros");
+    return 0;
+}
+
+// aplica um .delta (arquivo ou URL) sobre a DESTDIR instalada da versão antiga
+static int cmd_apply_delta(const Config&c, const std::string &src, Logger &log){
+    fs::path tmp = c.work/(".apply-"+std::to_string(getpid())), stage = tmp/"stage", file = src;
+    std::error_code ec;
+    fs::remove_all(tmp, ec);
+    fs::create_directories(stage);
+    auto cleanup = [&]{ discard_tree(c, tmp); };
+    if (src.find("://")!=std::string::npos){
+        file = tmp/"delta";
+        if (exec_cmd("curl -fsSL -o '"+file.string()+"' '"+src+"'", log, false)) { cleanup(); log.err("falha ao baixar "+src); return 1; }
+    }
+    uintmax_t deltaSize = fs::file_size(file, ec);
+    if (exec_cmd("bash -c \"set -o pipefail; zstd -dcq '"+file.string()+"' | tar -xf - -C '"+stage.string()+"'\"", log, false)){
+        cleanup(); log.err("delta ilegível: "+src); return 1;
+    }
+    std::ifstream in(stage/".DELTA");
+    std::string magic, line, name, from, to;
+    std::getline(in, magic);
+    auto fields = [](const std::string &l){ std::vector<std::string> v; std::istringstream ls(l); for (std::string f; std::getline(ls, f, '\t'); ) v.push_back(f); return v; };
+    std::vector<std::vector<std::string>> ops;
+    while (std::getline(in, line)){
+        auto f = fields(line);
+        if (f.size()==3 && f[0]=="from") { name = f[1]; from = f[2]; }
+        else if (f.size()==3 && f[0]=="to") to = f[2];
+        else if (!f.empty()) ops.push_back(f);
+    }
+    if (magic!="cbdelta 1" || name.empty() || from.empty() || to.empty()) { cleanup(); log.err("cabeçalho .DELTA inválido"); return 1; }
+    Recipe o; o.name = name; o.version = from;
+    Recipe n; n.name = name; n.version = to;
+    fs::path oldDest = destdir_pkg(c, o), newDest = destdir_pkg(c, n), build = newDest; build += ".delta";
+    if (!fs::exists(oldDest)) { cleanup(); log.err(name+"-"+from+" não está instalado em "+oldDest.string()); return 1; }
+
+    // o .SUMS novo vem do próprio delta: só vale se bater com o filesDigest de <nome>-<nova> no índice
+    {
+        cbpi::Index idx;
+        std::string digest;
+        if (idx.open(pkg_index_path(c))){
+            auto rg = idx.range(name);
+            for (uint32_t i=rg.first; i<rg.second; ++i) if (idx.at(i).version==to) digest = cbpi::tohex(idx.at(i).r->files);
+        }
+        if (digest.empty()) { cleanup(); log.err(name+"-"+to+" não está no índice "+pkg_index_path(c).string()+" (rode repo-pull)"); return 1; }
+        if (sha256::file(stage/".SUMS")!=digest) { cleanup(); log.err(".SUMS do delta não confere com o índice para "+name+"-"+to); return 1; }
+    }
+    // caminhos também vêm do delta: nada fora de build/, stage/ ou da DESTDIR antiga
+    for (auto &f: ops){
+        bool ok = f.size()>=2 && untar_safe(f[1]);
+        if (ok && f[0]=="copy") ok = f.size()>=4 && untar_safe(f[2]);
+        if (ok && f[0]=="patch") ok = f.size()>=5 && untar_safe(f[2]) && untar_safe(f[4]);
+        if (!ok) { cleanup(); log.err("entrada inválida no .DELTA: "+f[0]+(f.size()>1 ? " "+f[1] : "")); return 1; }
+    }
+
+    // arquivos antigos usados como base precisam ter o sha256 esperado
+    std::vector<fs::path> bases; std::vector<std::string> want;
+    for (auto &f: ops){
+        if (f[0]=="same" && f.size()>=3) { bases.push_back(oldDest/f[1]); want.push_back(f[2]); }
+        else if (f[0]=="copy" && f.size()>=4) { bases.push_back(oldDest/f[2]); want.push_back(f[3]); }
+        else if (f[0]=="patch" && f.size()>=5) { bases.push_back(oldDest/f[2]); want.push_back(f[3]); }
+    }
+    auto got = sha256::files(bases);
+    for (size_t i=0;i<bases.size();++i) if (got[i]!=want[i]) {
+        cleanup(); log.err("arquivo instalado difere do esperado: "+bases[i].string()+" (use o pacote inteiro)"); return 1;
+    }
+
+    fs::remove_all(build, ec);
+    fs::create_directories(build);
+    auto newSums = parse_sums([&]{ std::ifstream s(stage/".SUMS"); std::stringstream ss; ss << s.rdbuf(); return ss.str(); }());
+    // só arquivos regulares entram em build/ até aqui; os symlinks ficam para o fim, e nenhum
+    // caminho pode passar por um deles
+    std::vector<const std::vector<std::string>*> patches, links;
+    bool bad = false;
+    for (auto &f: ops){
+        fs::path dst = build/f[1];
+        fs::create_directories(dst.parent_path(), ec);
+        ec.clear();
+        if (f[0]=="same" || f[0]=="copy") fs::copy_file(oldDest/(f[0]=="same" ? f[1] : f[2]), dst, ec);
+        else if (f[0]=="file" && fs::symlink_status(stage/"files"/f[1], ec).type()==fs::file_type::regular) fs::rename(stage/"files"/f[1], dst, ec);
+        else if (f[0]=="link" && f.size()>=3) links.push_back(&f);
+        else if (f[0]=="patch" && fs::symlink_status(stage/f[4], ec).type()==fs::file_type::regular) patches.push_back(&f);
+        else bad = true;
+        if (ec) bad = true;
+    }
+    std::atomic<size_t> next{0};
+    std::atomic<bool> failed{false};
+    auto worker = [&]{
+        for (size_t i; (i=next++)<patches.size(); ){
+            auto &f = *patches[i];
+            if (exec_cmd("zstd -q -d --memory=2048MB --patch-from='"+(oldDest/f[2]).string()+"' '"+(stage/f[4]).string()+"' -o '"+(build/f[1]).string()+"'", log, false))
+                failed = true;
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned t=0; t<std::max(1u, std::thread::hardware_concurrency()); ++t) pool.emplace_back(worker);
+    for (auto &t: pool) t.join();
+    std::set<std::string> linked;
+    for (auto *f: links){
+        for (fs::path up = fs::path((*f)[1]).parent_path(); !up.empty(); up = up.parent_path()) if (linked.count(up.string())) bad = true;
+        if (bad) break;
+        fs::create_directories((build/(*f)[1]).parent_path(), ec);
+        fs::create_symlink((*f)[2], build/(*f)[1], ec);
+        if (ec) bad = true;
+        linked.insert((*f)[1]);
+    }
+    for (auto &e: newSums) if (!S_ISLNK(e.second.mode) && !bad) fs::permissions(build/e.first, (fs::perms)(e.second.mode & 07777), ec);
+    if (bad || failed) { fs::remove_all(build, ec); cleanup(); log.err("falha ao aplicar delta"); return 1; }
+
+    // a árvore montada tem que reproduzir o .SUMS da versão nova
+    fs::path sums = tmp/"check.sums";
+    write_sums(build, sums, log);
+    std::string a, b;
+    { std::ifstream x(sums); std::stringstream ss; ss << x.rdbuf(); a = ss.str(); }
+    { std::ifstream x(stage/".SUMS"); std::stringstream ss; ss << x.rdbuf(); b = ss.str(); }
+    if (a!=b) { fs::remove_all(build, ec); cleanup(); log.err("resultado não confere com o .SUMS de "+name+"-"+to); return 1; }
+    if (fs::exists(newDest)) discard_tree(c, newDest);
+    fs::rename(build, newDest, ec);
+    if (ec) { cleanup(); log.err("não foi possível criar "+newDest.string()+": "+ec.message()); return 1; }
+    fs::copy_file(stage/".SUMS", sums_file(c, n), fs::copy_options::overwrite_existing, ec);
+    {
+        std::ofstream m(install_manifest(c, n), std::ios::trunc);
+        for (auto &e: newSums) m << e.first << "\n";
+    }
+    cleanup();
+    log.ok(name+" "+from+" -> "+to+" em "+newDest.string()+" ("+std::to_string(ops.size())+" entradas, "+std::to_string(patches.size())+
+           " patches; delta de "+human_bytes(deltaSize)+")");
+    return 0;
+}
+
+// install-pkg: instala pacotes binários (com dependências, pelo índice) ou um .tar.zst avulso,
+// sem receitas. Cada pacote é extraído em paralelo numa DESTDIR nova ao lado e trocado por rename.
+static int cmd_install_pkg(const Config&c, const std::vector<std::string> &args, bool noDeps, bool force, Logger &log){
+    struct Item { fs::path file; std::string name, version, sha, filesDigest; };
+    std::vector<Item> items;
+    std::vector<std::string> names;
+    for (auto &a: args){
+        if (a.size()>8 && a.compare(a.size()-8, 8, ".tar.zst")==0 && fs::exists(a)) items.push_back({a, "", "", "", ""});
+        else names.push_back(a);
+    }
+    std::string url;
+    std::ifstream(c.base/"binrepo"/"url") >> url;
+    if (!names.empty()){
+        cbpi::Index idx;
+        if (!idx.open(pkg_index_path(c))) { log.err("índice ausente ou inválido: "+pkg_index_path(c).string()+" (rode repo-pull ou repo-index)"); return 1; }
+        std::vector<std::string> missing;
+        std::vector<uint32_t> order;
+        if (noDeps) { for (auto &n: names) { auto v = resolve_order(idx, {n}, missing, log); if (!v.empty()) order.push_back(v.back()); } }
+        else order = resolve_order(idx, names, missing, log);
+        if (!missing.empty()) { for (auto &m: missing) log.err("não encontrado no índice: "+m); return 1; }
+        for (auto i: order){
+            auto v = idx.at(i);
+            items.push_back({"", std::string(v.name), std::string(v.version), cbpi::tohex(v.r->sha), cbpi::tohex(v.r->files)});
+            // local quando o repositório está nesta máquina; senão baixa para binrepo/cache
+            fs::path local = c.binrepo/std::string(v.file), cached = c.base/"binrepo"/"cache"/std::string(v.file);
+            items.back().file = fs::exists(local) ? local : cached;
+        }
+    }
+    size_t done = 0;
+    for (auto &it: items){
+        Recipe r; r.name = it.name; r.version = it.version;
+        if (!it.name.empty() && !force && fs::exists(destdir_pkg(c,r)) && fs::exists(sums_file(c,r)) && sha256::file(sums_file(c,r))==it.filesDigest){
+            log.info(it.name+"-"+it.version+" já instalado");
+            continue;
+        }
+        if (!it.sha.empty() && (!fs::exists(it.file) || sha256::file(it.file)!=it.sha)){
+            if (url.empty()) { log.err(it.file.filename().string()+": não está no repositório local e não há url (rode repo-pull)"); return 1; }
+            fs::create_directories(it.file.parent_path());
+            fs::path part = it.file; part += ".part";
+            if (exec_cmd("curl -fsSL -o '"+part.string()+"' '"+url+it.file.filename().string()+"'", log, false) || sha256::file(part)!=it.sha){
+                std::error_code ec; fs::remove(part, ec);
+                log.err("falha ao baixar (ou sha256 divergente): "+url+it.file.filename().string()); return 1;
+            }
+            fs::rename(part, it.file);
+        }
+        // extrai em <destroot>/.install-<pid> e lê nome/versão do .PKGINFO
+        fs::path stage = c.destroot/(".install-"+std::to_string(getpid()));
+        std::error_code ec;
+        fs::remove_all(stage, ec);
+        std::map<std::string,std::string> meta = {{".PKGINFO", ""}, {".SUMS", ""}};
+        UntarStats st;
+        auto t0 = std::chrono::steady_clock::now();
+        int rc = run_at_prio(c.prio.at("install"), [&]{ return extract_tar("zstd -dcq '"+it.file.string()+"'", stage, c.install_jobs, c.install_sync, &meta, st, log); });
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count();
+        std::istringstream pi(meta[".PKGINFO"]);
+        for (std::string line; std::getline(pi, line); ){
+            if (line.rfind("pkgname = ",0)==0) r.name = line.substr(10);
+            else if (line.rfind("pkgver = ",0)==0) r.version = line.substr(9);
+        }
+        if (rc || r.name.empty() || r.version.empty() || meta[".SUMS"].empty()){
+            discard_tree(c, stage);
+            log.err("pacote inválido ou extração falhou: "+it.file.string()); return 1;
+        }
+        fs::path dest = destdir_pkg(c,r);
+        if (fs::exists(dest)) discard_tree(c, dest);
+        fs::rename(stage, dest, ec);
+        if (ec) { log.err("não foi possível criar "+dest.string()+": "+ec.message()); return 1; }
+        std::ofstream(sums_file(c,r), std::ios::binary|std::ios::trunc) << meta[".SUMS"];
+        {
+            std::ofstream m(install_manifest(c,r), std::ios::trunc);
+            for (auto &p: sums_paths(meta[".SUMS"])) m << p << "\n";
+        }
+        ++done;
+        log.ok("Instalado "+r.name+"-"+r.version+": "+std::to_string(st.files)+" arquivos, "+human_bytes(st.bytes)+" em "+fmt_secs(secs)+
+               " ("+human_bytes((uintmax_t)(st.bytes/std::max(secs, 1e-3)))+"/s)");
+    }
+    if (!done) log.ok("Nada a instalar");
+    return 0;
+}
+
+// repo-serve: HTTP/1.1 estático mínimo com Range e keep-alive, para testar repo-pull/resolve
+static void serve_conn(int fd, const fs::path &root){
+    std::string buf;
+    char tmp[8192];
+    for (;;){
+        size_t end;
+        while ((end = buf.find("\r\n\r\n"))==std::string::npos){
+            if (buf.size()>65536) { close(fd); return; }
+            ssize_t n = recv(fd, tmp, sizeof tmp, 0);
+            if (n<=0) { close(fd); return; }
+            buf.append(tmp, n);
+        }
+        std::string head = buf.substr(0, end);
+        buf.erase(0, end+4);
+        std::istringstream hs(head);
+        std::string method, target, proto, line;
+        hs >> method >> target >> proto;
+        std::getline(hs, line);
+        std::string range;
+        bool keep = proto=="HTTP/1.1";
+        while (std::getline(hs, line)){
+            if (!line.empty() && line.back()=='\r') line.pop_back();
+            auto colon = line.find(':');
+            if (colon==std::string::npos) continue;
+            std::string k = line.substr(0, colon), v = line.substr(colon+1);
+            std::transform(k.begin(), k.end(), k.begin(), ::tolower);
+            v.erase(0, v.find_first_not_of(' '));
+            if (k=="range") range = v;
+            else if (k=="connection") { std::transform(v.begin(), v.end(), v.begin(), ::tolower); keep = v!="close" && (keep || v=="keep-alive"); }
+        }
+        // caminho decodificado, sem query e sem "..": só arquivos regulares dentro de root
+        auto hex = [](char ch){ return ch>='0' && ch<='9' ? ch-'0' : ch>='a' && ch<='f' ? ch-'a'+10 : ch>='A' && ch<='F' ? ch-'A'+10 : -1; };
+        std::string path;
+        bool escape = true;   // %XX válido e sem NUL
+        for (size_t i=0;i<target.size() && target[i]!='?';++i){
+            if (target[i]!='%') { path += target[i]; continue; }
+            int hi = i+2<target.size() ? hex(target[i+1]) : -1, lo = hi<0 ? -1 : hex(target[i+2]);
+            if (hi<0 || lo<0 || (hi|lo)==0) { escape = false; break; }
+            path += (char)(hi*16+lo); i += 2;
+        }
+        bool bad = path.empty() || path[0]!='/';
+        for (auto &comp: fs::path(path)) if (comp=="..") bad = true;
+        fs::path file = root/fs::path(path).relative_path();
+        int ffd = -1; struct stat st{};
+        if (!bad && (method=="GET" || method=="HEAD")){
+            ffd = ::open(file.c_str(), O_RDONLY|O_CLOEXEC);
+            if (ffd>=0 && (fstat(ffd, &st)!=0 || !S_ISREG(st.st_mode))) { close(ffd); ffd = -1; }
+        }
+        auto reply = [&](const std::string &status, const std::string &extra, uint64_t len){
+            std::string h = "HTTP/1.1 "+status+"\r\nServer: cbuild\r\nAccept-Ranges: bytes\r\nContent-Length: "+std::to_string(len)+"\r\n"+extra+
+                            (keep ? "" : "Connection: close\r\n")+"\r\n";
+            return send(fd, h.data(), h.size(), MSG_NOSIGNAL)==(ssize_t)h.size();
+        };
+        bool ok;
+        if (!escape) ok = reply("400 Bad Request", "", 0);
+        else if (method!="GET" && method!="HEAD") ok = reply("405 Method Not Allowed", "Allow: GET, HEAD\r\n", 0);
+        else if (ffd<0) ok = reply("404 Not Found", "", 0);
+        else {
+            uint64_t size = st.st_size, a = 0, b = size ? size-1 : 0;
+            bool partial = false, unsat = false;
+            unsigned long long x, y;
+            if (range.rfind("bytes=",0)==0 && range.find(',')==std::string::npos){
+                std::string r = range.substr(6);
+                if (sscanf(r.c_str(), "%llu-%llu", &x, &y)==2) { a = x; b = std::min<uint64_t>(y, size-1); partial = true; unsat = a>b || a>=size; }
+                else if (sscanf(r.c_str(), "%llu-", &x)==1 && r.back()=='-') { a = x; partial = true; unsat = a>=size; }
+                else if (sscanf(r.c_str(), "-%llu", &y)==1) { a = y>=size ? 0 : size-y; partial = true; unsat = y==0; }
+            }
+            if (unsat) ok = reply("416 Range Not Satisfiable", "Content-Range: bytes */"+std::to_string(size)+"\r\n", 0);
+            else {
+                uint64_t len = size ? b-a+1 : 0;
+                ok = reply(partial ? "206 Partial Content" : "200 OK",
+                           "Content-Type: application/octet-stream\r\n"+(partial ? "Content-Range: bytes "+std::to_string(a)+"-"+std::to_string(b)+"/"+std::to_string(size)+"\r\n" : std::string()), len);
+                off_t off = a;
+                while (ok && method=="GET" && len>0){
+                    ssize_t n = sendfile(fd, ffd, &off, std::min<uint64_t>(len, 1<<20));
+                    if (n<=0) { ok = false; break; }
+                    len -= n;
+                }
+            }
+            std::cout << ansi::dim << method << " " << path << " " << (unsat ? 416 : partial ? 206 : 200) << ansi::reset << "\n" << std::flush;
+        }
+        if (ffd>=0) close(ffd);
+        if (!ok || !keep) { close(fd); return; }
+    }
+}
+
+static int cmd_repo_serve(const fs::path &root, const std::string &bind, int port, Logger &log){
+    int s = socket(AF_INET, SOCK_STREAM|SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+    sockaddr_in a{};
+    a.sin_family = AF_INET;
+    a.sin_port = htons(port);
+    if (s<0 || inet_pton(AF_INET, bind.c_str(), &a.sin_addr)!=1 || ::bind(s, (sockaddr*)&a, sizeof a)!=0 || listen(s, 64)!=0){
+        log.err("não foi possível escutar em "+bind+":"+std::to_string(port)+": "+strerror(errno));
+        return 1;
+    }
+    log.ok("Servindo "+root.string()+" em http://"+bind+":"+std::to_string(port)+"/ (Ctrl+C para sair)");
+    for (;;){
+        int fd = accept4(s, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd<0) { if (errno==EINTR) continue; break; }
+        std::thread(serve_conn, fd, root).detach();
+    }
+    close(s);
+    return 1;
+}
+
+// === diff: compara listas de arquivos com hash (.sums, pacotes, DESTDIRs, raiz viva) ===
+// As duas listas vêm ordenadas por caminho (.sums e .SUMS são gravados assim), então o diff é um
+// merge-join lendo uma linha de cada lado por vez: tempo linear e memória constante, inclusive
+// para pacotes, cujo .SUMS é lido direto do pipe do zstd. Contra a raiz viva (--root) cada
+// entrada é conferida no disco em lotes, com os sha256 do lote calculados em paralelo.
+struct DiffEntry { std::string path; mode_t mode{0}; uintmax_t size{0}; std::string sha; };
+
+struct DiffSource {
+    std::string label;
+    std::ifstream file;
+    FILE *pipe{nullptr};
+    std::string prev, peeked;
+    bool unsorted{false}, failed{false}, hasPeek{false};   // failed: o comando do pipe terminou com erro
+    std::string l;
+    char *buf{nullptr}; size_t cap{0};
+    ~DiffSource(){ if (pipe) pclose(pipe); free(buf); }
+    bool line(std::string &l){
+        if (hasPeek) { l.swap(peeked); hasPeek = false; return true; }
+        if (!pipe) return (bool)std::getline(file, l);
+        ssize_t n = getline(&buf, &cap, pipe);
+        if (n>0) l.assign(buf, buf[n-1]=='\n' ? n-1 : n);
+        else { failed = pclose(pipe)!=0; pipe = nullptr; }
+        return n>0;
+    }
+    // próxima entrada; linhas só com caminho (manifest) ficam sem modo/hash
+    bool next(DiffEntry &e){
+        while (line(l)){
+            if (l.empty()) continue;
+            size_t t1 = l.find('\t'), t2 = t1==std::string::npos ? t1 : l.find('\t', t1+1);
+            size_t t3 = t2==std::string::npos ? t2 : l.find('\t', t2+1);
+            e.path.assign(l, 0, t1);
+            if (t3!=std::string::npos){
+                e.mode = std::strtoul(l.c_str()+t1+1, nullptr, 8);
+                e.size = std::strtoull(l.c_str()+t2+1, nullptr, 10);
+                e.sha.assign(l, t3+1, l.find('\t', t3+1)-t3-1);
+            } else { e.mode = 0; e.size = 0; e.sha.clear(); }
+            if (!prev.empty() && e.path<=prev) { unsorted = true; return false; }
+            prev = e.path;
+            return true;
+        }
+        return false;
+    }
+};
+
+// arquivo .sums, pacote .tar.zst, outra lista (manifest, ordenada com sort), "nome-versão" instalado
+// ou "nome" (única versão instalada / receita)
+static bool open_diff_source(const Config&c, const std::string &spec, DiffSource &s, Logger &log){
+    s.label = spec;
+    fs::path p = spec;
+    if (fs::is_regular_file(p)){
+        std::string n = p.filename().string();
+        if (n.size()>8 && n.compare(n.size()-8, 8, ".tar.zst")==0){
+            s.pipe = popen(("zstd -dcq '"+p.string()+"' | tar --occurrence=1 -xOf - ./.SUMS 2>/dev/null").c_str(), "r");
+            // sem .SUMS (snapshot, tar de outra origem) a lista sairia vazia e tudo viraria +/-
+            if (!s.pipe || !s.line(s.peeked)) { log.err(spec+": sem ./.SUMS (não é pacote do cbuild?)"); return false; }
+            s.hasPeek = true;
+            return true;
+        }
+        if (n.size()>5 && n.compare(n.size()-5, 5, ".sums")==0) { s.file.open(p); return (bool)s.file; }
+        // manifest e listas de outros hosts podem vir em qualquer ordem: sort externo (memória limitada)
+        s.pipe = popen(("LC_ALL=C sort -u '"+p.string()+"'").c_str(), "r");
+        return s.pipe!=nullptr;
+    }
+    fs::path sums = c.logs/(spec+".sums");
+    if (!fs::exists(sums)){
+        std::vector<fs::path> found;
+        std::error_code ec;
+        for (auto &e: fs::directory_iterator(c.logs, ec)){
+            std::string n = e.path().filename().string();
+            // <spec>-<versão>.sums com a versão começando por dígito: "gcc" não pega gcc-libs-*
+            if (n.rfind(spec+"-",0)==0 && n.size()>spec.size()+6 && isdigit((unsigned char)n[spec.size()+1]) &&
+                n.compare(n.size()-5, 5, ".sums")==0 &&
+                fs::is_directory(c.destroot/n.substr(0, n.size()-5))) found.push_back(e.path());
+        }
+        if (found.size()==1) sums = found[0];
+        else {
+            Recipe r;
+            if (fs::exists(recipe_ini(c, spec)) && !ensure_recipe(c, spec, r, log)) sums = sums_file(c, r);
+            if (!fs::exists(sums)) { log.err(spec+": não é arquivo nem pacote instalado"+(found.size()>1 ? " (mais de uma versão; use nome-versão)" : "")); return false; }
+        }
+    }
+    s.label = sums.filename().string();
+    s.file.open(sums);
+    return (bool)s.file;
+}
+
+struct DiffCount { size_t added{0}, removed{0}, changed{0}, mode{0}, same{0}; };
+
+static void diff_report(const DiffEntry *a, const DiffEntry *b, bool quiet, DiffCount &n){
+    auto oct = [](mode_t m){ char s[8]; snprintf(s, sizeof s, "%o", (unsigned)(m & 07777)); return std::string(s); };
+    if (!a) { ++n.added; if (!quiet) std::cout << ansi::green << "+ " << b->path << ansi::reset << "\n"; return; }
+    if (!b) { ++n.removed; if (!quiet) std::cout << ansi::red << "- " << a->path << ansi::reset << "\n"; return; }
+    if (a->sha.empty() || b->sha.empty()) { ++n.same; return; }   // manifest sem hash: só presença
+    bool content = a->sha!=b->sha || (a->mode & S_IFMT)!=(b->mode & S_IFMT);
+    bool perm = (a->mode & 07777)!=(b->mode & 07777);
+    std::string modes = perm ? "  "+oct(a->mode)+" -> "+oct(b->mode) : "";
+    if (content){
+        ++n.changed;
+        if (!quiet) std::cout << ansi::yellow << "M " << a->path << ansi::reset << "  " << human_bytes(a->size) << " -> " << human_bytes(b->size) << modes << "\n";
+    } else if (perm){
+        ++n.mode;
+        if (!quiet) std::cout << ansi::cyan << "m " << a->path << ansi::reset << modes << "\n";
+    } else ++n.same;
+}
+
+// entradas de A conferidas contra <root>/<caminho>
+static bool diff_root(DiffSource &a, const fs::path &root, bool quiet, DiffCount &n){
+    const size_t BATCH = 2048;
+    std::vector<DiffEntry> as;
+    for (bool more = true; more; ){
+        as.clear();
+        DiffEntry e;
+        while (as.size()<BATCH && (more = a.next(e))) as.push_back(e);
+        std::vector<DiffEntry> live(as.size());
+        std::vector<bool> present(as.size(), false);
+        std::vector<fs::path> files; std::vector<size_t> idx;
+        for (size_t i=0;i<as.size();++i){
+            struct stat st{};
+            fs::path p = root/as[i].path;
+            if (lstat(p.c_str(), &st)!=0) continue;
+            present[i] = true;
+            live[i] = {as[i].path, st.st_mode, (uintmax_t)st.st_size, ""};
+            if (as[i].sha.empty()) continue;
+            if (S_ISLNK(st.st_mode)){
+                std::error_code ec;
+                live[i].sha = sha256::str(fs::read_symlink(p, ec).string());
+            } else if (S_ISREG(st.st_mode) && (uintmax_t)st.st_size==as[i].size) { files.push_back(p); idx.push_back(i); }
+            else live[i].sha = "-";   // tamanho ou tipo diferente: já mudou, não precisa ler
+        }
+        auto sums = sha256::files(files);
+        for (size_t k=0;k<idx.size();++k) live[idx[k]].sha = sums[k].empty() ? "-" : sums[k];
+        for (size_t i=0;i<as.size();++i) diff_report(&as[i], present[i] ? &live[i] : nullptr, quiet, n);
+    }
+    return !a.unsorted;
+}
+
+static int cmd_diff(const Config&c, const std::string &left, const std::string &right, const std::string &root, bool quiet, Logger &log){
+    DiffSource a, b;
+    if (!open_diff_source(c, left, a, log)) return 2;
+    DiffCount n;
+    bool ok;
+    std::string against = root.empty() ? right : "raiz "+root;
+    if (!root.empty()) ok = diff_root(a, root, quiet, n);
+    else {
+        if (!open_diff_source(c, right, b, log)) return 2;
+        DiffEntry x, y;
+        bool hx = a.next(x), hy = b.next(y);
+        while (hx || hy){
+            if (hy && (!hx || y.path<x.path)) { diff_report(nullptr, &y, quiet, n); hy = b.next(y); }
+            else if (hx && (!hy || x.path<y.path)) { diff_report(&x, nullptr, quiet, n); hx = a.next(x); }
+            else { diff_report(&x, &y, quiet, n); hx = a.next(x); hy = b.next(y); }
+        }
+        ok = !a.unsorted && !b.unsorted;
+        against = b.label;
+    }
+    if (a.failed || b.failed) { log.err("leitura de "+(a.failed ? a.label : b.label)+" falhou"); return 2; }
+    if (!ok) { log.err("entradas fora de ordem em "+(a.unsorted ? a.label : b.label)+" (esperado .sums ordenado por caminho)"); return 2; }
+    std::cout << ansi::bold << a.label << " -> " << against << ansi::reset << ": "
+              << n.added << " adicionados, " << n.removed << " removidos, " << n.changed << " alterados, "
+              << n.mode << " só modo, " << n.same << " iguais\n";
+    return (n.added || n.removed || n.changed || n.mode) ? 1 : 0;
+}
+
+static const std::map<std::string,std::string> aliases = {
+    {"dl","fetch"},{"x","extract"},{"p","patch"},{"b","build"},{"i","install"},{"rm","remove"},
+    {"srch","search"},{"inf","info"},{"rv","revdep"},{"mk","mkpkg"}
+};
+
+static std::string resolve_cmd(std::string c){
+    if (aliases.count(c)) return aliases.at(c);
+    std::vector<std::string> cmds = {"help","init","fetch","extract","patch","build","install","remove","info","search","sync","revdep","mkpkg","log","outdated","bump","watch","queue","plan","verify-sources","export-oci","export-image","dedup","package","repo-index","repo-pull","repo-serve","resolve","provides","delta","apply-delta","install-pkg","diff"};
+    std::vector<std::string> m;
+    for (auto &x:cmds) if (x.rfind(c,0)==0) m.push_back(x);
+    if (m.size()==1) return m[0];
+    return c;
+}
+
+static void print_help(){
+    std::cout << ansi::bold << "cbuild — ferramenta de build por receita" << ansi::reset << "\n";
+    std::cout << "Comandos:\n"
+              << "  init <nome>           cria receita\n"
+              << "  fetch <nome>          baixa fonte (curl/git) [suporta múltiplos tarballs]\n"
+              << "  extract <nome>        extrai para work/\n"
+              << "  patch <nome>          aplica patches http(s)/git/dir (git:@REF|A..B)\n"
+              << "  patch --check [nome...] [--jobs N]\n"
+              << "                        testa se os patches ainda aplicam (todas as receitas se vazio)\n"
+              << "  build <nome>          roda prebuild/prepare/configure/build\n"
+              << "  install <nome>        instala em DESTDIR (fakeroot) + postinstall [rollback]\n"
+              << "                        extract/build/install conferem disco e memória antes;\n"
+              << "                        --wait espera recursos em vez de recusar\n"
+              << "  remove <nome>         remove DESTDIR + hook pós-remover [snapshot]\n"
+              << "  info <nome>           mostra infos da receita\n"
+              << "  search <regex>        busca em receitas\n"
+              << "  sync                  commit/push recipes/ (se origin configurado) e atualiza [repos]\n"
+              << "  revdep <nome>         verifica libs usadas pelos binários\n"
+              << "  mkpkg <nome>          cria pasta do programa + receita juntos\n"
+              << "  log <nome> [--run N] [--phase F] [--grep RE] [--list]\n"
+              << "                        mostra o log de uma execução (comprimido por fase)\n"
+              << "  outdated [--all] [--refresh]\n"
+              << "                        verifica versões upstream de todas as receitas\n"
+              << "  bump <nome> <versão> | bump <nome=versão>... | bump --outdated\n"
+              << "                        [--dry-run] [--force] atualiza versão, urls e sha256\n"
+              << "  watch [--enqueue] [--debounce MS]\n"
+              << "                        acompanha recipes/ e repo/ via inotify, mantendo o cache\n"
+              << "  queue [--run|--clear] lista/executa a fila de builds (fetch..install)\n"
+              << "  verify-sources [--jobs N] [--delete-corrupt]\n"
+              << "                        confere sources/ contra os sha256= de todas as receitas\n"
+              << "  export-oci <dir> <nome|a+b>... [--tag T] [--gzip]\n"
+              << "                        layout OCI com uma camada por argumento (incremental)\n"
+              << "  export-image <arquivo> <nome>... [--format squashfs|erofs] | --tree DIR <nome>...\n"
+              << "                        imagem somente leitura com os pacotes (dedup entre eles)\n"
+              << "  dedup [--reflink] [--dry-run] [--min-size B]\n"
+              << "                        liga arquivos idênticos entre as DESTDIRs instaladas\n"
+              << "  package <nome>        gera pacote binário .tar.zst no repositório e atualiza o índice\n"
+              << "  repo-index [dir]      reconstrói o índice (index.cbpi) de um diretório de pacotes\n"
+              << "  repo-serve [dir] [--port N] [--bind IP]\n"
+              << "                        servidor HTTP (com Range) do repositório binário\n"
+              << "  repo-pull [--url U]   baixa só os blocos alterados do índice remoto\n"
+              << "  resolve <nome>... [--index F] [--json]\n"
+              << "                        ordem de instalação pelo índice, sem receitas\n"
+              << "  provides <caminho|basename|glob>... [--index F]\n"
+              << "                        pacotes do repositório binário que fornecem o arquivo\n"
+              << "  delta <nome> <antiga> [nova]\n"
+              << "                        pacote delta entre duas versões do repositório binário\n"
+              << "  install-pkg <nome|arquivo.tar.zst>... [--no-deps] [--force]\n"
+              << "                        instala pacotes binários do índice (com dependências)\n"
+              << "  apply-delta <arquivo|url>\n"
+              << "                        aplica o delta sobre a versão instalada, conferindo os sha256\n"
+              << "  diff <a> <b> | diff <a> --root DIR [--summary]\n"
+              << "                        compara .sums, pacotes .tar.zst ou pacotes instalados\n"
+              << "  plan [nome...] [--jobs N] [--dot|--json]\n"
+              << "                        mostra o que seria refeito, caminho crítico e tempo estimado\n"
+              << "\nAliases: dl, x, p, b, i, rm, srch, inf, rv, mk\n";
+}
+
+int main(int argc, char **argv){
+    std::ios::sync_with_stdio(false);
+    Config cfg = make_default_config();
+    fs::create_directories(cfg.base);
+
+    std::string cmd = (argc>=2) ? argv[1] : "help";
+    cmd = resolve_cmd(cmd);
+
+    fs::path logpath = cfg.logs/"cbuild.log";
+    Logger log(logpath);
+    Recipe::search_roots.push_back(cfg.recipes);
+    for (auto &r: cfg.repos) Recipe::search_roots.push_back(cfg.repo/r.name);
+    log.gcPrio = cfg.prio["gc"];
+    log.rotate(cfg.log_max_mb*1024*1024, cfg.log_rotate);
+
+    if (cmd=="help") { print_help(); return 0; }
+
+    auto need_name = [&](int minArgc){ if (argc<minArgc) { std::cerr << "Uso: "<<argv[0]<<" "<<cmd<<" <nome>\n"; return false;} return true; };
+    // opções no formato --chave valor / --flag, depois do nome
+    auto opt = [&](const std::string &k, const std::string &def="")->std::string{
+        for (int i=2;i+1<argc;++i) if (argv[i]==k) return argv[i+1];
+        return def;
+    };
+    auto flag = [&](const std::string &k){ for (int i=2;i<argc;++i) if (argv[i]==k) return true; return false; };
+    // etapas de um pacote ganham um log próprio em logs/<pkg>/<N>.log
+    CpuSlot placement;
+    auto start_run = [&](const Recipe &r){
+        log.begin_run(cfg.logs/r.name, cmd+" "+r.name+"-"+r.version, cfg.log_keep);
+        if (cmd=="build" || cmd=="install") placement.apply(cfg, log);
+        log.phase(cmd);
+    };
+
+    try{
+        if (cmd=="init"){
+            if (!need_name(3)) return 1; return cmd_init(cfg, argv[2], log);
+        } else if (cmd=="fetch"){
+            if (!need_name(3)) return 1; Recipe r; if(ensure_recipe(cfg, argv[2], r, log)) return 1; start_run(r); return run_at_prio(cfg.prio["fetch"], [&]{ return cmd_fetch(cfg,r,log); });
+        } else if (cmd=="extract"){
+            if (!need_name(3)) return 1; Recipe r; if(ensure_recipe(cfg, argv[2], r, log)) return 1; start_run(r);
+            if (int rc = preflight(cfg, r, "extract", flag("--wait"), log)) return rc;
+            return run_at_prio(cfg.prio["extract"], [&]{ return cmd_extract(cfg,r,log); });
+        } else if (cmd=="patch" && flag("--check")){
+            std::vector<std::string> names;
+            for (int i=2;i<argc;++i){
+                std::string a = argv[i];
+                if (a=="--jobs") { ++i; continue; }
+                if (a.rfind("--",0)!=0) names.push_back(a);
+            }
+            return cmd_patch_check(cfg, names, std::max(1, std::atoi(opt("--jobs", std::to_string(cfg.outdated_jobs)).c_str())), log);
+        } else if (cmd=="patch"){
+            if (!need_name(3)) return 1; Recipe r; if(ensure_recipe(cfg, argv[2], r, log)) return 1; start_run(r); return run_at_prio(cfg.prio["extract"], [&]{ return cmd_patch(cfg,r,log); });
+        } else if (cmd=="build"){
+            if (!need_name(3)) return 1; Recipe r; if(ensure_recipe(cfg, argv[2], r, log)) return 1; start_run(r);
+            if (int rc = preflight(cfg, r, "build", flag("--wait"), log)) return rc;
+            return run_at_prio(cfg.prio["build"], [&]{ return cmd_build_all(cfg,r,log); });
+        } else if (cmd=="install"){
+            if (!need_name(3)) return 1; Recipe r; if(ensure_recipe(cfg, argv[2], r, log)) return 1; start_run(r);
+            if (int rc = preflight(cfg, r, "install", flag("--wait"), log)) return rc;
+            return run_at_prio(cfg.prio["install"], [&]{ return cmd_install(cfg,r,log); });
+        } else if (cmd=="remove"){
+            if (!need_name(3)) return 1; Recipe r; if(ensure_recipe(cfg, argv[2], r, log)) return 1; start_run(r); return cmd_remove(cfg,r,log);
+        } else if (cmd=="info"){
+            if (!need_name(3)) return 1; Recipe r; if(ensure_recipe(cfg, argv[2], r, log)) return 1; return cmd_info(cfg,r,log);
+        } else if (cmd=="search"){
+            if (!need_name(3)) return 1; return cmd_search(cfg, argv[2], log);
+        } else if (cmd=="sync"){
+            return cmd_sync(cfg, log);
+        } else if (cmd=="revdep"){
+            if (!need_name(3)) return 1; Recipe r; if(ensure_recipe(cfg, argv[2], r, log)) return 1; return cmd_revdep(cfg,r,log);
+        } else if (cmd=="mkpkg"){
+            if (!need_name(3)) return 1; return cmd_mkpkg(cfg, argv[2], log);
+        } else if (cmd=="outdated"){
+            return cmd_outdated(cfg, flag("--all"), flag("--refresh"), log);
+        } else if (cmd=="bump"){
+            std::vector<std::string> pos;
+            for (int i=2;i<argc;++i) if (std::string(argv[i]).rfind("--",0)!=0) pos.push_back(argv[i]);
+            std::vector<std::pair<std::string,std::string>> targets;
+            if (flag("--outdated")){
+                for (auto &row: check_upstream(cfg, flag("--refresh")))
+                    if (!row.latest.empty() && version_cmp(row.latest, row.current)>0) targets.push_back({row.name, row.latest});
+            } else if (pos.size()==2 && pos[0].find('=')==std::string::npos && pos[1].find('=')==std::string::npos){
+                targets.push_back({pos[0], pos[1]});
+            } else for (auto &p: pos){
+                auto eq = p.find('=');
+                if (eq==std::string::npos) { std::cerr << "Uso: "<<argv[0]<<" bump <nome> <versão> | <nome=versão>...\n"; return 1; }
+                targets.push_back({p.substr(0,eq), p.substr(eq+1)});
+            }
+            if (targets.empty()) { log.info("Nada para atualizar"); return 0; }
+            return cmd_bump(cfg, targets, flag("--dry-run"), flag("--force"), log);
+        } else if (cmd=="watch"){
+            return cmd_watch(cfg, flag("--enqueue"), std::atoi(opt("--debounce", std::to_string(cfg.watch_debounce_ms)).c_str()), log);
+        } else if (cmd=="queue"){
+            return cmd_queue(cfg, flag("--run"), flag("--clear"), log);
+        } else if (cmd=="verify-sources"){
+            return cmd_verify_sources(cfg, std::atoi(opt("--jobs", std::to_string(cfg.verify_jobs)).c_str()), flag("--delete-corrupt"), log);
+        } else if (cmd=="export-oci"){
+            std::vector<std::string> pos;
+            for (int i=2;i<argc;++i){
+                std::string a = argv[i];
+                if (a=="--tag") { ++i; continue; }
+                if (a.rfind("--",0)!=0) pos.push_back(a);
+            }
+            if (pos.size()<2) { std::cerr << "Uso: "<<argv[0]<<" export-oci <dir> <nome|a+b>... [--tag T] [--gzip]\n"; return 1; }
+            std::vector<std::string> groups(pos.begin()+1, pos.end());
+            return cmd_export_oci(cfg, pos[0], groups, opt("--tag", "latest"), flag("--gzip"), log);
+        } else if (cmd=="export-image"){
+            std::vector<std::string> pos;
+            for (int i=2;i<argc;++i){
+                std::string a = argv[i];
+                if (a=="--format" || a=="--tree") { ++i; continue; }
+                if (a.rfind("--",0)!=0) pos.push_back(a);
+            }
+            // com --tree DIR só a árvore unificada é gerada, sem arquivo de imagem
+            std::string tree = opt("--tree");
+            size_t first = tree.empty() ? 1 : 0;
+            if (pos.size()<first+1) { std::cerr << "Uso: "<<argv[0]<<" export-image <arquivo> <nome>... [--format squashfs|erofs] | --tree DIR <nome>...\n"; return 1; }
+            std::string fmt = opt("--format", "squashfs");
+            if (fmt!="squashfs" && fmt!="erofs") { log.err("formato desconhecido: "+fmt); return 2; }
+            return cmd_export_image(cfg, first ? pos[0] : "", std::vector<std::string>(pos.begin()+first, pos.end()), fmt, tree, log);
+        } else if (cmd=="dedup"){
+            return cmd_dedup(cfg, flag("--reflink"), flag("--dry-run"), std::strtoull(opt("--min-size","1").c_str(), nullptr, 10), log);
+        } else if (cmd=="package"){
+            if (!need_name(3)) return 1; Recipe r; if(ensure_recipe(cfg, argv[2], r, log)) return 1; return cmd_package(cfg, r, log);
+        } else if (cmd=="repo-index"){
+            return cmd_repo_index(cfg, argc>=3 && argv[2][0]!='-' ? fs::path(argv[2]) : cfg.binrepo, log);
+        } else if (cmd=="repo-serve"){
+            fs::path dir = argc>=3 && argv[2][0]!='-' ? fs::path(argv[2]) : cfg.binrepo;
+            return cmd_repo_serve(dir, opt("--bind", "127.0.0.1"), std::atoi(opt("--port", "8080").c_str()), log);
+        } else if (cmd=="repo-pull"){
+            return cmd_repo_pull(cfg, opt("--url", cfg.binrepo_url), log);
+        } else if (cmd=="resolve"){
+            std::vector<std::string> names;
+            for (int i=2;i<argc;++i){
+                std::string a = argv[i];
+                if (a=="--index") { ++i; continue; }
+                if (a.rfind("--",0)!=0) names.push_back(a);
+            }
+            if (names.empty()) { std::cerr << "Uso: "<<argv[0]<<" resolve <nome>... [--index F] [--json]\n"; return 1; }
+            return cmd_resolve(cfg, names, opt("--index"), flag("--json"), log);
+        } else if (cmd=="provides"){
+            std::vector<std::string> qs;
+            for (int i=2;i<argc;++i){
+                std::string a = argv[i];
+                if (a=="--index") { ++i; continue; }
+                if (a.rfind("--",0)!=0) qs.push_back(a);
+            }
+            if (qs.empty()) { std::cerr << "Uso: "<<argv[0]<<" provides <caminho|basename|glob>... [--index F]\n"; return 1; }
+            return cmd_provides(cfg, qs, opt("--index"), log);
+        } else if (cmd=="delta"){
+            if (argc<4) { std::cerr << "Uso: "<<argv[0]<<" delta <nome> <versão-antiga> [versão-nova]\n"; return 1; }
+            return cmd_delta(cfg, argv[2], argv[3], argc>=5 ? argv[4] : "", log);
+        } else if (cmd=="install-pkg"){
+            std::vector<std::string> pos;
+            for (int i=2;i<argc;++i) if (std::string(argv[i]).rfind("--",0)!=0) pos.push_back(argv[i]);
+            if (pos.empty()) { std::cerr << "Uso: "<<argv[0]<<" install-pkg <nome|arquivo.tar.zst>... [--no-deps] [--force]\n"; return 1; }
+            return cmd_install_pkg(cfg, pos, flag("--no-deps"), flag("--force"), log);
+        } else if (cmd=="apply-delta"){
+            if (!need_name(3)) return 1; return cmd_apply_delta(cfg, argv[2], log);
+        } else if (cmd=="diff"){
+            std::vector<std::string> pos;
+            for (int i=2;i<argc;++i){
+                std::string a = argv[i];
+                if (a=="--root") { ++i; continue; }
+                if (a.rfind("--",0)!=0) pos.push_back(a);
+            }
+            std::string root = opt("--root");
+            if (pos.size()!=(root.empty() ? 2u : 1u)) { std::cerr << "Uso: "<<argv[0]<<" diff <a> <b> | diff <a> --root DIR [--summary]\n"; return 2; }
+            return cmd_diff(cfg, pos[0], root.empty() ? pos[1] : "", root, flag("--summary"), log);
+        } else if (cmd=="plan"){
+            std::vector<std::string> names;
+            for (int i=2;i<argc;++i){
+                std::string a = argv[i];
+                if (a=="--jobs") { ++i; continue; }
+                if (a.rfind("--",0)!=0) names.push_back(a);
+            }
+            int jobs = std::atoi(opt("--jobs", std::to_string(std::max(1u, std::thread::hardware_concurrency()))).c_str());
+            return cmd_plan(cfg, names, jobs, flag("--json") ? "json" : flag("--dot") ? "dot" : "", log);
+        } else if (cmd=="log"){
+            if (!need_name(3)) return 1;
+            return cmd_log(cfg, argv[2], std::atoi(opt("--run","0").c_str()), opt("--phase"), opt("--grep"), flag("--list"), log);
         } else {
             log.err("Comando desconhecido: "+cmd);
             print_help();